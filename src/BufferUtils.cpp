@@ -92,3 +92,26 @@ void BufferUtils::CreateBufferFromData(Device* device, VkCommandPool commandPool
     vkDestroyBuffer(device->GetVkDevice(), stagingBuffer, nullptr);
     vkFreeMemory(device->GetVkDevice(), stagingBufferMemory, nullptr);
 }
+
+
+void BufferUtils::ReadBufferData(Device* device, VkCommandPool commandPool, VkBuffer buffer, VkDeviceSize bufferSize, void* bufferData) {
+    // Create the staging buffer
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+
+    VkBufferUsageFlags stagingUsage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    VkMemoryPropertyFlags stagingProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    BufferUtils::CreateBuffer(device, bufferSize, stagingUsage, stagingProperties, stagingBuffer, stagingBufferMemory);
+
+    // Copy data from buffer to staging (the buffer needs VK_BUFFER_USAGE_TRANSFER_SRC_BIT)
+    BufferUtils::CopyBuffer(device, commandPool, buffer, stagingBuffer, bufferSize);
+
+    // Read back the staging buffer
+    void *data;
+    vkMapMemory(device->GetVkDevice(), stagingBufferMemory, 0, bufferSize, 0, &data);
+    memcpy(bufferData, data, static_cast<size_t>(bufferSize));
+    vkUnmapMemory(device->GetVkDevice(), stagingBufferMemory);
+
+    vkDestroyBuffer(device->GetVkDevice(), stagingBuffer, nullptr);
+    vkFreeMemory(device->GetVkDevice(), stagingBufferMemory, nullptr);
+}
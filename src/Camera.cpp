@@ -14,9 +14,7 @@ Camera::Camera(Device* device, float aspectRatio) : device(device), eye(glm::vec
     cameraBufferObject.projectionMatrix = glm::perspective(glm::radians(45.0f), aspectRatio, 0.1f, 50.0f);
     cameraBufferObject.projectionMatrix[1][1] *= -1; // y-coordinate is flipped
 
-    BufferUtils::CreateBuffer(device, sizeof(CameraBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, bufferMemory);
-    vkMapMemory(device->GetVkDevice(), bufferMemory, 0, sizeof(CameraBufferObject), 0, &mappedData);
-    memcpy(mappedData, &cameraBufferObject, sizeof(CameraBufferObject));
+    BufferUtils::CreateBuffer(device, sizeof(CameraBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, bufferMemory);
 }
 
 
@@ -31,9 +29,7 @@ Camera::Camera(Device* device, float aspectRatio, glm::vec3 eye, float nearPlane
 	cameraBufferObject.projectionMatrix = glm::perspective(glm::radians(60.0f), aspectRatio, nearPlane, farPlane);
 	cameraBufferObject.projectionMatrix[1][1] *= -1; // y-coordinate is flipped
 
-	BufferUtils::CreateBuffer(device, sizeof(CameraBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, bufferMemory);
-	vkMapMemory(device->GetVkDevice(), bufferMemory, 0, sizeof(CameraBufferObject), 0, &mappedData);
-	memcpy(mappedData, &cameraBufferObject, sizeof(CameraBufferObject));
+	BufferUtils::CreateBuffer(device, sizeof(CameraBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, bufferMemory);
 }
 
 
@@ -42,6 +38,11 @@ VkBuffer Camera::GetBuffer() const {
 }
 
 
+const CameraBufferObject& Camera::GetBufferObject() const {
+    return cameraBufferObject;
+}
+
+
 void Camera::UpdateOrbit(float deltaX, float deltaY, float deltaZ) {
     theta += deltaX;
     phi += deltaY;
@@ -54,8 +55,6 @@ void Camera::UpdateOrbit(float deltaX, float deltaY, float deltaZ) {
     glm::mat4 finalTransform = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f)) * rotation * glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 1.0f, r));
 
     cameraBufferObject.viewMatrix = glm::inverse(finalTransform);
-
-    memcpy(mappedData, &cameraBufferObject, sizeof(CameraBufferObject));
 }
 
 
@@ -65,12 +64,10 @@ void Camera::TranslateCamera(glm::vec3 translation) {
 	glm::vec3 normal = normalize(this->eye - glm::vec3(0.f, 1.f, 0.0));
 
 	cameraBufferObject.viewMatrix = glm::lookAt(6.5f * normal, glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-	memcpy(mappedData, &cameraBufferObject, sizeof(CameraBufferObject));
 }
 
 
 Camera::~Camera() {
-  vkUnmapMemory(device->GetVkDevice(), bufferMemory);
   vkDestroyBuffer(device->GetVkDevice(), buffer, nullptr);
   vkFreeMemory(device->GetVkDevice(), bufferMemory, nullptr);
 }
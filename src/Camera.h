@@ -15,11 +15,10 @@ private:
     
     CameraBufferObject cameraBufferObject;
     
+    // Device local, the renderer writes cameraBufferObject to it at the start of each frame's draws
     VkBuffer buffer;
     VkDeviceMemory bufferMemory;
 
-    void* mappedData;
-
     float r, theta, phi;
 	glm::vec3 eye;
 
@@ -29,6 +28,7 @@ public:
     ~Camera();
 
     VkBuffer GetBuffer() const;
+    const CameraBufferObject& GetBufferObject() const;
     
     void UpdateOrbit(float deltaX, float deltaY, float deltaZ);
 	void TranslateCamera(glm::vec3 translation);
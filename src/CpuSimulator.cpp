@@ -0,0 +1,693 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "CpuSimulator.h"
+#include "Simd.h"
+
+namespace {
+	// Keep in sync with shaders/simulation.glsl and integrate.comp
+	const float DAMPING = 0.998f;
+	const float STRAND_LENGTH = 2.5f;
+	const float MAX_SPEED = 10.0f;
+	const float FRICTION = 0.08f;
+
+	// Strands per task handed to the thread pool
+	const int STRANDS_PER_TASK = 256;
+
+	static_assert(sizeof(GridCell) == 4 * sizeof(int), "GridCell must match the shader layout");
+}
+
+
+CpuSimulator::CpuSimulator(const std::vector<Strand>& strands, const std::vector<Collider>& colliders) : colliders(colliders) {
+	grid.resize(GRID_DIM * GRID_DIM * GRID_DIM, GridCell(glm::ivec3(0), 0));
+	SetStrands(strands);
+}
+
+
+void CpuSimulator::SetStrands(const std::vector<Strand>& strands) {
+	numStrands = (int)strands.size();
+	numCurvePoints = strands.empty() ? DEFAULT_NUM_CURVE_POINTS : (int)strands[0].curvePoints.size();
+	stride = ((numStrands + simd::Width - 1) / simd::Width) * simd::Width;
+
+	std::vector<float>* arrays[] = { &posX, &posY, &posZ, &velX, &velY, &velZ, &predX, &predY, &predZ, &corrX, &corrY, &corrZ };
+	for (std::vector<float>* array : arrays) {
+		array->resize(numCurvePoints * stride);
+	}
+
+	// Padding lanes repeat the first strand so they never produce NaNs or denormals
+	for (int s = 0; s < stride; ++s) {
+		const Strand& strand = strands[s < numStrands ? s : 0];
+		for (int i = 0; i < numCurvePoints; ++i) {
+			const int index = i * stride + s;
+			posX[index] = strand.curvePoints[i].x;
+			posY[index] = strand.curvePoints[i].y;
+			posZ[index] = strand.curvePoints[i].z;
+			velX[index] = strand.curveVels[i].x;
+			velY[index] = strand.curveVels[i].y;
+			velZ[index] = strand.curveVels[i].z;
+		}
+	}
+}
+
+
+void CpuSimulator::GetStrands(std::vector<Strand>& strands) const {
+	strands.resize(numStrands);
+	for (int s = 0; s < numStrands; ++s) {
+		Strand& strand = strands[s];
+		strand.curvePoints.resize(numCurvePoints);
+		strand.curveVels.resize(numCurvePoints);
+		for (int i = 0; i < numCurvePoints; ++i) {
+			const int index = i * stride + s;
+			strand.curvePoints[i] = glm::vec4(posX[index], posY[index], posZ[index], 1.0f);
+			strand.curveVels[i] = glm::vec4(velX[index], velY[index], velZ[index], 0.0f);
+		}
+	}
+}
+
+
+void CpuSimulator::SetColliders(const std::vector<Collider>& colliders) {
+	this->colliders = colliders;
+}
+
+
+void CpuSimulator::SetSdf(const Sdf* sdf) {
+	this->sdf = sdf != nullptr && !sdf->Empty() ? sdf : nullptr;
+}
+
+
+int CpuSimulator::GetNumStrands() const {
+	return numStrands;
+}
+
+
+int CpuSimulator::GetNumCurvePoints() const {
+	return numCurvePoints;
+}
+
+
+void CpuSimulator::SetSolver(StrandSolver solver) {
+	this->solver = solver;
+}
+
+
+const std::vector<GridCell>& CpuSimulator::GetGrid() const {
+	return grid;
+}
+
+
+const GridFrame& CpuSimulator::GetGridFrame() const {
+	return gridFrame;
+}
+
+
+void CpuSimulator::Step(float deltaTime) {
+	IntegrateStrands(0, stride, deltaTime);
+
+	glm::vec3 lo(std::numeric_limits<float>::max());
+	glm::vec3 hi(-std::numeric_limits<float>::max());
+	GrowBounds(0, numStrands, lo, hi);
+	gridFrame = FitGrid(lo, hi);
+
+	brickPoints.resize(1);
+	brickPoints[0].resize(GRID_BRICKS_PER_AXIS * GRID_BRICKS_PER_AXIS * GRID_BRICKS_PER_AXIS, 0);
+	CountBrickPoints(0, numStrands, brickPoints[0].data());
+	FitGridScale();
+
+	std::fill(grid.begin(), grid.end(), GridCell(glm::ivec3(0), 0));
+	TransferToGrid(0, numStrands, grid.data());
+	TransferFromGrid(0, stride, grid.data());
+}
+
+
+void CpuSimulator::Step(float deltaTime, ThreadPool& pool) {
+	const int numThreads = pool.GetNumThreads();
+	if ((int)partialGrids.size() != numThreads) {
+		partialGrids.assign(numThreads, std::vector<GridCell>(grid.size(), GridCell(glm::ivec3(0), 0)));
+		touchedSlices.assign(numThreads, std::vector<unsigned char>(GRID_DIM, 0));
+	}
+	partialLo.assign(numThreads, glm::vec3(std::numeric_limits<float>::max()));
+	partialHi.assign(numThreads, glm::vec3(-std::numeric_limits<float>::max()));
+
+	// Each task owns whole strands, so the FTL chain runs on one core. The scatter has to wait for the grid to be
+	// fitted to every strand
+	const int batchesPerTask = std::max(STRANDS_PER_TASK / simd::Width, 1);
+	const int numBatches = stride / simd::Width;
+	pool.ParallelFor(numBatches, batchesPerTask, [&](int begin, int end, int worker) {
+		IntegrateStrands(begin * simd::Width, end * simd::Width, deltaTime);
+		GrowBounds(begin * simd::Width, end * simd::Width, partialLo[worker], partialHi[worker]);
+	});
+
+	glm::vec3 lo = partialLo[0];
+	glm::vec3 hi = partialHi[0];
+	for (int t = 1; t < numThreads; ++t) {
+		lo = glm::min(lo, partialLo[t]);
+		hi = glm::max(hi, partialHi[t]);
+	}
+	gridFrame = FitGrid(lo, hi);
+
+	brickPoints.resize(numThreads);
+	for (std::vector<uint32_t>& points : brickPoints) {
+		points.resize(GRID_BRICKS_PER_AXIS * GRID_BRICKS_PER_AXIS * GRID_BRICKS_PER_AXIS, 0);
+	}
+	pool.ParallelFor(numBatches, batchesPerTask, [&](int begin, int end, int worker) {
+		CountBrickPoints(begin * simd::Width, end * simd::Width, brickPoints[worker].data());
+	});
+	FitGridScale();
+
+	pool.ParallelFor(numBatches, batchesPerTask, [&](int begin, int end, int worker) {
+		TransferToGrid(begin * simd::Width, end * simd::Width, partialGrids[worker].data(), touchedSlices[worker].data());
+	});
+
+	pool.ParallelFor(GRID_DIM, 1, [&](int begin, int end, int /*worker*/) {
+		ReduceGrid(begin, end);
+	});
+
+	pool.ParallelFor(numBatches, batchesPerTask, [&](int begin, int end, int /*worker*/) {
+		TransferFromGrid(begin * simd::Width, end * simd::Width, grid.data());
+	});
+}
+
+
+void CpuSimulator::ReduceGrid(int beginSlice, int endSlice) {
+	const size_t sliceSize = GRID_DIM * GRID_DIM;
+
+	for (int slice = beginSlice; slice < endSlice; ++slice) {
+		GridCell* cells = &grid[slice * sliceSize];
+		std::fill(cells, cells + sliceSize, GridCell(glm::ivec3(0), 0));
+
+		for (size_t t = 0; t < partialGrids.size(); ++t) {
+			if (!touchedSlices[t][slice]) {
+				continue;
+			}
+
+			GridCell* partial = &partialGrids[t][slice * sliceSize];
+			for (size_t i = 0; i < sliceSize; ++i) {
+				cells[i].velocity += partial[i].velocity;
+				cells[i].density += partial[i].density;
+			}
+			std::fill(partial, partial + sliceSize, GridCell(glm::ivec3(0), 0));
+			touchedSlices[t][slice] = 0;
+		}
+	}
+}
+
+
+void CpuSimulator::IntegrateStrands(int begin, int end, float deltaTime) {
+	using namespace simd;
+
+	const Float zero(0.0f);
+	const Float one(1.0f);
+	const Float dt(deltaTime);
+	const Float radius(STRAND_LENGTH / (numCurvePoints - 1.0f));
+	const Float damping(DAMPING);
+	const Float maxSpeed(MAX_SPEED);
+
+	// Velocity, clamp and correction vector of a point moved from p to its solved position
+	auto finishPoint = [&](int current, Float px, Float py, Float pz, Float newX, Float newY, Float newZ, Float predictedX, Float predictedY, Float predictedZ) {
+		Float newVelX = damping * ((newX - px) / dt);
+		Float newVelY = damping * ((newY - py) / dt);
+		Float newVelZ = damping * ((newZ - pz) / dt);
+		Float speed = Sqrt(newVelX * newVelX + newVelY * newVelY + newVelZ * newVelZ);
+		Mask tooFast = speed > maxSpeed;
+		newVelX = Select(tooFast, (newVelX / speed) * maxSpeed, newVelX);
+		newVelY = Select(tooFast, (newVelY / speed) * maxSpeed, newVelY);
+		newVelZ = Select(tooFast, (newVelZ / speed) * maxSpeed, newVelZ);
+
+		newX.Store(&posX[current]);
+		newY.Store(&posY[current]);
+		newZ.Store(&posZ[current]);
+		newVelX.Store(&velX[current]);
+		newVelY.Store(&velY[current]);
+		newVelZ.Store(&velZ[current]);
+		(damping * (newX - predictedX)).Store(&corrX[current]);
+		(damping * (newY - predictedY)).Store(&corrY[current]);
+		(damping * (newZ - predictedZ)).Store(&corrZ[current]);
+	};
+
+	// Moves the points that went from prev to p this step out of the candidate colliders and the SDF collider, as
+	// ProjectCollisions does it
+	auto projectCollisions = [&](const int* candidates, int numCandidates, Float prevX, Float prevY, Float prevZ, Float& px, Float& py, Float& pz) {
+		for (int j = 0; j < numCandidates; ++j) {
+			const Collider& c = colliders[candidates[j]];
+
+			// Path of the point in the collider's frame, against the unit sphere
+			Float ox = prevX - Float(c.previousCenter.x);
+			Float oy = prevY - Float(c.previousCenter.y);
+			Float oz = prevZ - Float(c.previousCenter.z);
+			Float startX = (Float(c.axes[0].x) * ox + Float(c.axes[0].y) * oy + Float(c.axes[0].z) * oz) / Float(c.radii.x);
+			Float startY = (Float(c.axes[1].x) * ox + Float(c.axes[1].y) * oy + Float(c.axes[1].z) * oz) / Float(c.radii.y);
+			Float startZ = (Float(c.axes[2].x) * ox + Float(c.axes[2].y) * oy + Float(c.axes[2].z) * oz) / Float(c.radii.z);
+			ox = px - Float(c.center.x);
+			oy = py - Float(c.center.y);
+			oz = pz - Float(c.center.z);
+			Float tx = (Float(c.axes[0].x) * ox + Float(c.axes[0].y) * oy + Float(c.axes[0].z) * oz) / Float(c.radii.x);
+			Float ty = (Float(c.axes[1].x) * ox + Float(c.axes[1].y) * oy + Float(c.axes[1].z) * oz) / Float(c.radii.y);
+			Float tz = (Float(c.axes[2].x) * ox + Float(c.axes[2].y) * oy + Float(c.axes[2].z) * oz) / Float(c.radii.z);
+			Float pathX = tx - startX;
+			Float pathY = ty - startY;
+			Float pathZ = tz - startZ;
+
+			Float a = pathX * pathX + pathY * pathY + pathZ * pathZ;
+			Float b = startX * pathX + startY * pathY + startZ * pathZ;
+			Float startOutside = startX * startX + startY * startY + startZ * startZ - one;
+			Float discriminant = b * b - a * startOutside;
+			Float nearRoot = zero - b - Sqrt(Max(discriminant, zero));
+			Mask swept = (startOutside > zero) & (b < zero) & (discriminant >= zero) & (nearRoot <= a);
+
+			Float localLengthSq = tx * tx + ty * ty + tz * tz;
+			Mask inside = localLengthSq < one;
+			if (!Any(swept | inside)) {
+				continue;
+			}
+
+			// Where the surface first reached the point, or straight out from the center if it started inside
+			Float t = nearRoot / a;
+			Float localLength = Sqrt(localLengthSq);
+			tx = Select(swept, startX + t * pathX, tx / localLength);
+			ty = Select(swept, startY + t * pathY, ty / localLength);
+			tz = Select(swept, startZ + t * pathZ, tz / localLength);
+
+			Float ux = tx * Float(c.radii.x);
+			Float uy = ty * Float(c.radii.y);
+			Float uz = tz * Float(c.radii.z);
+			Mask moved = swept | inside;
+			px = Select(moved, Float(c.center.x) + Float(c.axes[0].x) * ux + Float(c.axes[1].x) * uy + Float(c.axes[2].x) * uz, px);
+			py = Select(moved, Float(c.center.y) + Float(c.axes[0].y) * ux + Float(c.axes[1].y) * uy + Float(c.axes[2].y) * uz, py);
+			pz = Select(moved, Float(c.center.z) + Float(c.axes[0].z) * ux + Float(c.axes[1].z) * uy + Float(c.axes[2].z) * uz, pz);
+		}
+
+		// SDF collider, one sample per lane
+		if (sdf != nullptr) {
+			float laneX[Width], laneY[Width], laneZ[Width];
+			px.Store(laneX);
+			py.Store(laneY);
+			pz.Store(laneZ);
+			for (int lane = 0; lane < Width; ++lane) {
+				glm::vec3 position(laneX[lane], laneY[lane], laneZ[lane]);
+				glm::vec4 sample = sdf->Sample(position);
+				glm::vec3 gradient(sample);
+				if (sample.w < 0.0f && glm::dot(gradient, gradient) > 1e-12f) {
+					position -= sample.w * glm::normalize(gradient);
+					laneX[lane] = position.x;
+					laneY[lane] = position.y;
+					laneZ[lane] = position.z;
+				}
+			}
+			px = Float::Load(laneX);
+			py = Float::Load(laneY);
+			pz = Float::Load(laneZ);
+		}
+	};
+
+	for (int s = begin; s < end; s += Width) {
+		// Predictions only depend on the state before the step, so both solvers start from them
+		for (int i = 1; i < numCurvePoints; ++i) {
+			const int current = i * stride + s;
+
+			// Add gravity
+			Float fx(0.0f);
+			Float fy(-9.8f);
+			Float fz(0.0f);
+
+			// Get predicted position based on position, velocity, and force
+			(Float::Load(&posX[current]) + dt * Float::Load(&velX[current]) + dt * dt * fx).Store(&predX[current]);
+			(Float::Load(&posY[current]) + dt * Float::Load(&velY[current]) + dt * dt * fy).Store(&predY[current]);
+			(Float::Load(&posZ[current]) + dt * Float::Load(&velZ[current]) + dt * dt * fz).Store(&predZ[current]);
+		}
+
+		// Broad phase as StrandColliders does it, with one box around the points and predictions of all the lanes
+		Float loX = Float::Load(&posX[s]), loY = Float::Load(&posY[s]), loZ = Float::Load(&posZ[s]);
+		Float hiX = loX, hiY = loY, hiZ = loZ;
+		for (int i = 1; i < numCurvePoints; ++i) {
+			const int current = i * stride + s;
+			loX = Min(loX, Min(Float::Load(&posX[current]), Float::Load(&predX[current])));
+			loY = Min(loY, Min(Float::Load(&posY[current]), Float::Load(&predY[current])));
+			loZ = Min(loZ, Min(Float::Load(&posZ[current]), Float::Load(&predZ[current])));
+			hiX = Max(hiX, Max(Float::Load(&posX[current]), Float::Load(&predX[current])));
+			hiY = Max(hiY, Max(Float::Load(&posY[current]), Float::Load(&predY[current])));
+			hiZ = Max(hiZ, Max(Float::Load(&posZ[current]), Float::Load(&predZ[current])));
+		}
+		const float segment = STRAND_LENGTH / (numCurvePoints - 1.0f);
+		glm::vec3 lo = glm::vec3(HorizontalMin(loX), HorizontalMin(loY), HorizontalMin(loZ)) - segment;
+		glm::vec3 hi = glm::vec3(HorizontalMax(hiX), HorizontalMax(hiY), HorizontalMax(hiZ)) + segment;
+
+		int candidates[MAX_COLLIDERS];
+		int numCandidates = 0;
+		for (size_t j = 0; j < colliders.size() && j < MAX_COLLIDERS; ++j) {
+			glm::vec3 center = 0.5f * glm::vec3(colliders[j].center + colliders[j].previousCenter);
+			float reach = colliders[j].center.w + 0.5f * glm::distance(glm::vec3(colliders[j].center), glm::vec3(colliders[j].previousCenter));
+			if (glm::distance(glm::clamp(center, lo, hi), center) <= reach) {
+				candidates[numCandidates++] = (int)j;
+			}
+		}
+
+		// Project the predictions out of the colliders, so follow the leader aims the segments around them
+		for (int i = 1; i < numCurvePoints; ++i) {
+			const int current = i * stride + s;
+			Float predictedX = Float::Load(&predX[current]);
+			Float predictedY = Float::Load(&predY[current]);
+			Float predictedZ = Float::Load(&predZ[current]);
+			projectCollisions(candidates, numCandidates, Float::Load(&posX[current]), Float::Load(&posY[current]), Float::Load(&posZ[current]), predictedX, predictedY, predictedZ);
+			predictedX.Store(&predX[current]);
+			predictedY.Store(&predY[current]);
+			predictedZ.Store(&predZ[current]);
+		}
+
+		if (solver == StrandSolver::ThreadPerStrand || STRAND_GROUP_FTL_PASSES == 0) {
+			// Apply follow the leader constraint, point by point from the root, then collisions again in case the
+			// segment swung into a collider
+			for (int i = 1; i < numCurvePoints; ++i) {
+				const int current = i * stride + s;
+				const int parent = current - stride;
+
+				Float parentX = Float::Load(&posX[parent]);
+				Float parentY = Float::Load(&posY[parent]);
+				Float parentZ = Float::Load(&posZ[parent]);
+				Float predictedX = Float::Load(&predX[current]);
+				Float predictedY = Float::Load(&predY[current]);
+				Float predictedZ = Float::Load(&predZ[current]);
+
+				Float dirX = predictedX - parentX;
+				Float dirY = predictedY - parentY;
+				Float dirZ = predictedZ - parentZ;
+				Float dirLength = Sqrt(dirX * dirX + dirY * dirY + dirZ * dirZ);
+				Float newX = parentX + radius * (dirX / dirLength);
+				Float newY = parentY + radius * (dirY / dirLength);
+				Float newZ = parentZ + radius * (dirZ / dirLength);
+
+				Float px = Float::Load(&posX[current]);
+				Float py = Float::Load(&posY[current]);
+				Float pz = Float::Load(&posZ[current]);
+				projectCollisions(candidates, numCandidates, px, py, pz, newX, newY, newZ);
+				finishPoint(current, px, py, pz, newX, newY, newZ, predictedX, predictedY, predictedZ);
+			}
+		}
+		else {
+			SolveChainParallel(s);
+
+			for (int i = 1; i < numCurvePoints; ++i) {
+				const int current = i * stride + s;
+				Float px = Float::Load(&corrX[current]);
+				Float py = Float::Load(&corrY[current]);
+				Float pz = Float::Load(&corrZ[current]);
+				Float newX = Float::Load(&posX[current]);
+				Float newY = Float::Load(&posY[current]);
+				Float newZ = Float::Load(&posZ[current]);
+				projectCollisions(candidates, numCandidates, px, py, pz, newX, newY, newZ);
+				finishPoint(current, px, py, pz, newX, newY, newZ,
+					Float::Load(&predX[current]), Float::Load(&predY[current]), Float::Load(&predZ[current]));
+			}
+		}
+
+		// Apply velocity correction term from the next point down the strand
+		for (int i = 1; i < numCurvePoints - 1; ++i) {
+			const int current = i * stride + s;
+			const int child = current + stride;
+			(Float::Load(&velX[current]) - Float::Load(&corrX[child]) / dt).Store(&velX[current]);
+			(Float::Load(&velY[current]) - Float::Load(&corrY[child]) / dt).Store(&velY[current]);
+			(Float::Load(&velZ[current]) - Float::Load(&corrZ[child]) / dt).Store(&velZ[current]);
+		}
+	}
+}
+
+
+void CpuSimulator::SolveChainParallel(int s) {
+	using namespace simd;
+
+	const Float radius(STRAND_LENGTH / (numCurvePoints - 1.0f));
+
+	// The chain is built in the positions, keep the ones from before the step in the correction vectors
+	for (int i = 1; i < numCurvePoints; ++i) {
+		const int current = i * stride + s;
+		Float::Load(&posX[current]).Store(&corrX[current]);
+		Float::Load(&posY[current]).Store(&corrY[current]);
+		Float::Load(&posZ[current]).Store(&corrZ[current]);
+	}
+
+	// Same passes as integrateStrandGroup.comp, with the prefix sums done in order
+	for (int pass = 0; pass < STRAND_GROUP_FTL_PASSES; ++pass) {
+		Float chainX = Float::Load(&posX[s]);
+		Float chainY = Float::Load(&posY[s]);
+		Float chainZ = Float::Load(&posZ[s]);
+		Float anchorX = chainX;
+		Float anchorY = chainY;
+		Float anchorZ = chainZ;
+
+		for (int i = 1; i < numCurvePoints; ++i) {
+			const int current = i * stride + s;
+			Float predictedX = Float::Load(&predX[current]);
+			Float predictedY = Float::Load(&predY[current]);
+			Float predictedZ = Float::Load(&predZ[current]);
+
+			Float dirX = predictedX - anchorX;
+			Float dirY = predictedY - anchorY;
+			Float dirZ = predictedZ - anchorZ;
+			Float dirLength = Sqrt(dirX * dirX + dirY * dirY + dirZ * dirZ);
+
+			// Next segment starts where this point was in the last pass, or at its prediction in the first
+			anchorX = pass == 0 ? predictedX : Float::Load(&posX[current]);
+			anchorY = pass == 0 ? predictedY : Float::Load(&posY[current]);
+			anchorZ = pass == 0 ? predictedZ : Float::Load(&posZ[current]);
+
+			chainX = chainX + radius * (dirX / dirLength);
+			chainY = chainY + radius * (dirY / dirLength);
+			chainZ = chainZ + radius * (dirZ / dirLength);
+			chainX.Store(&posX[current]);
+			chainY.Store(&posY[current]);
+			chainZ.Store(&posZ[current]);
+		}
+	}
+}
+
+
+void CpuSimulator::GrowBounds(int begin, int end, glm::vec3& lo, glm::vec3& hi) const {
+	end = std::min(end, numStrands);
+	for (int i = 0; i < numCurvePoints; ++i) {
+		for (int s = begin; s < end; ++s) {
+			const int index = i * stride + s;
+			glm::vec3 p(posX[index], posY[index], posZ[index]);
+			lo = glm::min(lo, p);
+			hi = glm::max(hi, p);
+		}
+	}
+}
+
+
+void CpuSimulator::CountBrickPoints(int begin, int end, uint32_t* brickPoints) const {
+	const glm::vec3 origin = gridFrame.origin;
+	const float h = gridFrame.cellSize;
+	end = std::min(end, numStrands);
+
+	for (int s = begin; s < end; ++s) {
+		for (int i = 1; i < numCurvePoints; ++i) {
+			const int index = i * stride + s;
+			float x = (posX[index] - origin.x) / h;
+			float y = (posY[index] - origin.y) / h;
+			float z = (posZ[index] - origin.z) / h;
+
+			// Same cells as the scatter, each brick they fall in counts the point once
+			int xmin = std::max((int)std::floor(x), 0);
+			int xmax = std::min((int)std::floor(x) + 1, GRID_DIM - 1);
+			int ymin = std::max((int)std::floor(y), 0);
+			int ymax = std::min((int)std::floor(y) + 1, GRID_DIM - 1);
+			int zmin = std::max((int)std::floor(z), 0);
+			int zmax = std::min((int)std::floor(z) + 1, GRID_DIM - 1);
+			if (xmin > xmax || ymin > ymax || zmin > zmax) {
+				continue;
+			}
+
+			for (int a = xmin / GRID_BRICK_DIM; a <= xmax / GRID_BRICK_DIM; ++a) {
+				for (int b = ymin / GRID_BRICK_DIM; b <= ymax / GRID_BRICK_DIM; ++b) {
+					for (int c = zmin / GRID_BRICK_DIM; c <= zmax / GRID_BRICK_DIM; ++c) {
+						++brickPoints[a + b * GRID_BRICKS_PER_AXIS + c * GRID_BRICKS_PER_AXIS * GRID_BRICKS_PER_AXIS];
+					}
+				}
+			}
+		}
+	}
+}
+
+
+void CpuSimulator::FitGridScale() {
+	uint32_t maxBrickPoints = 0;
+	const size_t numBricks = brickPoints[0].size();
+	for (size_t brick = 0; brick < numBricks; ++brick) {
+		uint32_t points = 0;
+		for (std::vector<uint32_t>& partial : brickPoints) {
+			points += partial[brick];
+			partial[brick] = 0;
+		}
+		maxBrickPoints = std::max(maxBrickPoints, points);
+	}
+	gridScale = GridScale(maxBrickPoints);
+}
+
+
+void CpuSimulator::TransferToGrid(int begin, int end, GridCell* grid, unsigned char* touchedSlices) const {
+	// Scatter stays scalar, lanes would collide on the same cells
+	const glm::vec3 origin = gridFrame.origin;
+	const float h = gridFrame.cellSize;
+	end = std::min(end, numStrands);
+
+	for (int s = begin; s < end; ++s) {
+		for (int i = 1; i < numCurvePoints; ++i) {
+			const int index = i * stride + s;
+
+			// Get grid index position of curve point
+			float x = (posX[index] - origin.x) / h;
+			float y = (posY[index] - origin.y) / h;
+			float z = (posZ[index] - origin.z) / h;
+
+			int xmin = std::max((int)std::floor(x), 0);
+			int xmax = std::min((int)std::floor(x) + 1, GRID_DIM - 1);
+			int ymin = std::max((int)std::floor(y), 0);
+			int ymax = std::min((int)std::floor(y) + 1, GRID_DIM - 1);
+			int zmin = std::max((int)std::floor(z), 0);
+			int zmax = std::min((int)std::floor(z) + 1, GRID_DIM - 1);
+
+			if (touchedSlices) {
+				for (int c = zmin; c <= zmax; ++c) {
+					touchedSlices[c] = 1;
+				}
+			}
+
+			// Clamped to what the fixed point sums have room for
+			const float vx = glm::clamp(velX[index], -GRID_MAX_SPEED, GRID_MAX_SPEED);
+			const float vy = glm::clamp(velY[index], -GRID_MAX_SPEED, GRID_MAX_SPEED);
+			const float vz = glm::clamp(velZ[index], -GRID_MAX_SPEED, GRID_MAX_SPEED);
+
+			for (int a = xmin; a <= xmax; ++a) {
+				for (int b = ymin; b <= ymax; ++b) {
+					for (int c = zmin; c <= zmax; ++c) {
+						float xWeight = glm::clamp(1.0f - std::fabs(x - a), 0.0f, 1.0f);
+						float yWeight = glm::clamp(1.0f - std::fabs(y - b), 0.0f, 1.0f);
+						float zWeight = glm::clamp(1.0f - std::fabs(z - c), 0.0f, 1.0f);
+						float totalWeight = xWeight * yWeight * zWeight;
+
+						// Same fixed point encoding as the shader's atomics
+						GridCell& cell = grid[a + b * GRID_DIM + c * GRID_DIM * GRID_DIM];
+						cell.velocity.x += (int)(gridScale * (totalWeight * vx));
+						cell.velocity.y += (int)(gridScale * (totalWeight * vy));
+						cell.velocity.z += (int)(gridScale * (totalWeight * vz));
+						cell.density += (int)(gridScale * totalWeight);
+					}
+				}
+			}
+		}
+	}
+}
+
+
+void CpuSimulator::TransferFromGrid(int begin, int end, const GridCell* grid) {
+	using namespace simd;
+
+	const Float zero(0.0f);
+	const Float one(1.0f);
+	const Float h(gridFrame.cellSize);
+	const Float originX(gridFrame.origin.x);
+	const Float originY(gridFrame.origin.y);
+	const Float originZ(gridFrame.origin.z);
+	const Float lastCell((float)(GRID_DIM - 1));
+	const Float friction(FRICTION);
+
+	// Cells are gathered as four ints: velocity xyz, then density
+	const int* cells = reinterpret_cast<const int*>(grid);
+
+	for (int s = begin; s < end; s += Width) {
+		for (int i = 1; i < numCurvePoints; ++i) {
+			const int index = i * stride + s;
+
+			// Get index grid space position
+			Float x = (Float::Load(&posX[index]) - originX) / h;
+			Float y = (Float::Load(&posY[index]) - originY) / h;
+			Float z = (Float::Load(&posZ[index]) - originZ) / h;
+			Float x0 = Floor(x);
+			Float y0 = Floor(y);
+			Float z0 = Floor(z);
+
+			Float gridVelX(0.0f);
+			Float gridVelY(0.0f);
+			Float gridVelZ(0.0f);
+
+			// The shader's [max(floor, 0), min(floor + 1, GRID_DIM - 1)] loops are the two
+			// neighbouring cells on each axis, masked to the ones inside the grid
+			for (int a = 0; a < 2; ++a) {
+				Float cellX = x0 + Float((float)a);
+				Mask insideX = (cellX >= zero) & (cellX <= lastCell);
+				Float xWeight = Clamp(one - Abs(x - cellX), zero, one);
+
+				for (int b = 0; b < 2; ++b) {
+					Float cellY = y0 + Float((float)b);
+					Mask insideY = insideX & (cellY >= zero) & (cellY <= lastCell);
+					Float yWeight = Clamp(one - Abs(y - cellY), zero, one);
+
+					for (int c = 0; c < 2; ++c) {
+						Float cellZ = z0 + Float((float)c);
+						Mask inside = insideY & (cellZ >= zero) & (cellZ <= lastCell);
+						if (!Any(inside)) {
+							continue;
+						}
+						Float zWeight = Clamp(one - Abs(z - cellZ), zero, one);
+
+						Float cellIndex = (cellX + cellY * Float((float)GRID_DIM) + cellZ * Float((float)(GRID_DIM * GRID_DIM))) * Float(4.0f);
+						Int cell = ToInt(Select(inside, cellIndex, zero));
+
+						Int density = Gather(cells + 3, cell, inside);
+						Mask filled = inside & (density > Int(0));
+						if (!Any(filled)) {
+							continue;
+						}
+
+						Float weight = xWeight * yWeight * zWeight * (one / ToFloat(density));
+						gridVelX = Select(filled, gridVelX + weight * ToFloat(Gather(cells, cell, filled)), gridVelX);
+						gridVelY = Select(filled, gridVelY + weight * ToFloat(Gather(cells + 1, cell, filled)), gridVelY);
+						gridVelZ = Select(filled, gridVelZ + weight * ToFloat(Gather(cells + 2, cell, filled)), gridVelZ);
+					}
+				}
+			}
+
+			// Mix previous velocity and grid velocity using friction
+			(((one - friction) * Float::Load(&velX[index])) + friction * gridVelX).Store(&velX[index]);
+			(((one - friction) * Float::Load(&velY[index])) + friction * gridVelY).Store(&velY[index]);
+			(((one - friction) * Float::Load(&velZ[index])) + friction * gridVelZ).Store(&velZ[index]);
+		}
+	}
+}
+
+
+SimulationDivergence CpuSimulator::Compare(const std::vector<Strand>& reference, const std::vector<Strand>& strands) {
+	SimulationDivergence divergence;
+	size_t count = std::min(reference.size(), strands.size());
+	double positionSum = 0.0;
+	double velocitySum = 0.0;
+	size_t numPoints = 0;
+
+	for (size_t s = 0; s < count; ++s) {
+		const int numCurvePoints = (int)std::min(reference[s].curvePoints.size(), strands[s].curvePoints.size());
+		if ((int)divergence.maxPositionErrorPerPoint.size() < numCurvePoints) {
+			divergence.maxPositionErrorPerPoint.resize(numCurvePoints, 0.0f);
+		}
+		numPoints += numCurvePoints;
+
+		for (int i = 0; i < numCurvePoints; ++i) {
+			float positionError = glm::distance(glm::vec3(reference[s].curvePoints[i]), glm::vec3(strands[s].curvePoints[i]));
+			float velocityError = glm::distance(glm::vec3(reference[s].curveVels[i]), glm::vec3(strands[s].curveVels[i]));
+			positionSum += positionError;
+			velocitySum += velocityError;
+
+			divergence.maxPositionErrorPerPoint[i] = std::max(divergence.maxPositionErrorPerPoint[i], positionError);
+			divergence.maxVelocityError = std::max(divergence.maxVelocityError, velocityError);
+			if (positionError > divergence.maxPositionError || divergence.worstStrand < 0) {
+				divergence.maxPositionError = positionError;
+				divergence.worstStrand = (int)s;
+				divergence.worstCurvePoint = i;
+			}
+		}
+	}
+
+	if (numPoints > 0) {
+		divergence.meanPositionError = (float)(positionSum / numPoints);
+		divergence.meanVelocityError = (float)(velocitySum / numPoints);
+	}
+	return divergence;
+}
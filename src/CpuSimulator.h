@@ -0,0 +1,116 @@
+#pragma once
+
+#include <vector>
+#include "Strand.h"
+#include "Scene.h"
+#include "ThreadPool.h"
+
+// Per curve point difference between two sets of strands
+struct SimulationDivergence {
+	float maxPositionError = 0.0f;
+	float meanPositionError = 0.0f;
+	float maxVelocityError = 0.0f;
+	float meanVelocityError = 0.0f;
+	int worstStrand = -1;
+	int worstCurvePoint = -1;
+
+	// Largest position error seen at each curve point index, root first
+	std::vector<float> maxPositionErrorPerPoint;
+};
+
+
+// Host-side reference of the simulation step run by shaders/integrate.comp, gridBounds.comp, particleToGrid.comp,
+// gridNormalize.comp and gridToParticle.comp. The grid here is dense; the GPU's sparse brick grid sums to the
+// same values unless more than GRID_MAX_BRICKS bricks are reached and some contributions are dropped.
+// Grid sums are always fixed point, a GPU using float atomics differs by their rounding.
+// Strands are stored as structure of arrays, one lane per strand, so the integration and
+// grid gather run Width strands at a time on AVX2 / SSE2 (see Simd.h).
+class CpuSimulator {
+private:
+	int numStrands;
+
+	// Taken from the strands passed in, every strand must have the same count
+	int numCurvePoints;
+
+	// Strands padded up to a multiple of the SIMD width; element [point * stride + strand]
+	int stride;
+
+	std::vector<float> posX, posY, posZ;
+	std::vector<float> velX, velY, velZ;
+
+	// Predicted position and follow-the-leader correction of each point, scratch rewritten every step
+	std::vector<float> predX, predY, predZ;
+	std::vector<float> corrX, corrY, corrZ;
+
+	StrandSolver solver = StrandSolver::ThreadPerStrand;
+
+	std::vector<Collider> colliders;
+	const Sdf* sdf = nullptr;
+	std::vector<GridCell> grid;
+
+	// Fitted to the curve points after integration each step, as shaders/gridBounds.comp does
+	GridFrame gridFrame = { GRID_ORIGIN, GRID_HEIGHT / GRID_DIM };
+
+	// Per worker bounds of the strands it integrated
+	std::vector<glm::vec3> partialLo, partialHi;
+
+	// Fixed point scale of the grid sums, from the point counts of the grid bricks as shaders/gridAllocate.comp
+	// counts them. Per worker counts for the threaded step
+	float gridScale = GridScale(1);
+	std::vector<std::vector<uint32_t>> brickPoints;
+
+	// Per worker grids for the threaded scatter, plus which z slices each one has written
+	std::vector<std::vector<GridCell>> partialGrids;
+	std::vector<std::vector<unsigned char>> touchedSlices;
+
+	// Follow-the-leader integration with collider projection and the velocity correction
+	void IntegrateStrands(int begin, int end, float deltaTime);
+
+	// Follow the leader as solved by StrandSolver::WorkgroupPerStrand for the Width strands at s: solved
+	// positions go to pos, the ones from before the step to corr
+	void SolveChainParallel(int s);
+
+	// Grows lo and hi to the curve points of strands [begin, end)
+	void GrowBounds(int begin, int end, glm::vec3& lo, glm::vec3& hi) const;
+
+	// Adds the points of strands [begin, end) reaching each grid brick to brickPoints
+	void CountBrickPoints(int begin, int end, uint32_t* brickPoints) const;
+
+	// Picks gridScale for the densest brick across the brick counts, and clears them
+	void FitGridScale();
+
+	// Scatters velocity and density of the curve points into the grid, flagging the z slices written
+	void TransferToGrid(int begin, int end, GridCell* grid, unsigned char* touchedSlices = nullptr) const;
+
+	// Sums the partial grids of the given z slices into the grid and clears them for the next step
+	void ReduceGrid(int beginSlice, int endSlice);
+
+	// Blends the grid velocity back into the curve points (friction)
+	void TransferFromGrid(int begin, int end, const GridCell* grid);
+
+public:
+	CpuSimulator() = delete;
+	CpuSimulator(const std::vector<Strand>& strands, const std::vector<Collider>& colliders);
+
+	void SetStrands(const std::vector<Strand>& strands);
+	void GetStrands(std::vector<Strand>& strands) const;
+	void SetColliders(const std::vector<Collider>& colliders);
+
+	// Mesh collider sampled next to the colliders, kept by the caller. None if null or empty
+	void SetSdf(const Sdf* sdf);
+
+	// Which GPU integrate stage to reproduce, thread per strand unless set
+	void SetSolver(StrandSolver solver);
+
+	int GetNumStrands() const;
+	int GetNumCurvePoints() const;
+	const std::vector<GridCell>& GetGrid() const;
+	const GridFrame& GetGridFrame() const;
+
+	void Step(float deltaTime);
+
+	// Same step spread across the pool. Fixed point grid sums make the result independent of the thread count
+	void Step(float deltaTime, ThreadPool& pool);
+
+	static SimulationDivergence Compare(const std::vector<Strand>& reference, const std::vector<Strand>& strands);
+};
@@ -1,5 +1,7 @@
+#include <cstring>
 #include <stdexcept>
 #include <set>
+#include <string>
 #include <vector>
 #include "Instance.h"
 
@@ -63,6 +65,18 @@ Instance::Instance(const char* applicationName, unsigned int additionalExtension
     for (unsigned int i = 0; i < additionalExtensionCount; ++i) {
         extensions.push_back(additionalExtensions[i]);
     }
+
+    // Needed to query extension features on Vulkan 1.0, see GetDeviceFeatures
+    uint32_t availableExtensionCount = 0;
+    vkEnumerateInstanceExtensionProperties(nullptr, &availableExtensionCount, nullptr);
+    std::vector<VkExtensionProperties> availableExtensions(availableExtensionCount);
+    vkEnumerateInstanceExtensionProperties(nullptr, &availableExtensionCount, availableExtensions.data());
+    for (const auto& extension : availableExtensions) {
+        if (strcmp(extension.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0) {
+            extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+            hasPhysicalDeviceProperties2 = true;
+        }
+    }
     createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
     createInfo.ppEnabledExtensionNames = extensions.data();
 
@@ -226,6 +240,16 @@ namespace {
             i++;
         }
 
+        // Prefer a compute family without graphics, so the simulation runs on its own queue alongside rendering
+        if (requiredQueues[QueueFlags::Compute]) {
+            for (int j = 0; j < static_cast<int>(queueFamilies.size()); ++j) {
+                if (queueFamilies[j].queueCount > 0 && (queueFamilies[j].queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queueFamilies[j].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+                    indices[QueueFlags::Compute] = j;
+                    break;
+                }
+            }
+        }
+
         return indices;
     }
 
@@ -312,7 +336,45 @@ void Instance::PickPhysicalDevice(std::vector<const char*> deviceExtensions, Que
 }
 
 
-Device* Instance::CreateDevice(QueueFlagBits requiredQueues, VkPhysicalDeviceFeatures deviceFeatures) {
+bool Instance::IsDeviceExtensionSupported(const char* extension) const {
+    return checkDeviceExtensionSupport(physicalDevice, { extension });
+}
+
+
+void Instance::EnableDeviceExtension(const char* extension) {
+    deviceExtensions.push_back(extension);
+}
+
+
+bool Instance::IsDeviceExtensionEnabled(const char* extension) const {
+    for (const char* enabled : deviceExtensions) {
+        if (strcmp(enabled, extension) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+bool Instance::GetDeviceFeatures(void* features) const {
+    if (!hasPhysicalDeviceProperties2) {
+        return false;
+    }
+
+    auto func = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR");
+    if (func == nullptr) {
+        return false;
+    }
+
+    VkPhysicalDeviceFeatures2KHR features2 = {};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+    features2.pNext = features;
+    func(physicalDevice, &features2);
+    return true;
+}
+
+
+Device* Instance::CreateDevice(QueueFlagBits requiredQueues, VkPhysicalDeviceFeatures deviceFeatures, const void* extensionFeatures) {
     std::set<int> uniqueQueueFamilies;
     bool queueSupport = true;
     for (unsigned int i = 0; i < requiredQueues.size(); ++i) {
@@ -345,6 +407,7 @@ Device* Instance::CreateDevice(QueueFlagBits requiredQueues, VkPhysicalDeviceFea
     createInfo.pQueueCreateInfos = queueCreateInfos.data();
 
     createInfo.pEnabledFeatures = &deviceFeatures;
+    createInfo.pNext = extensionFeatures;
 
     // Enable device-specific extensions and validation layers
     createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
@@ -26,7 +26,16 @@ public:
 
     void PickPhysicalDevice(std::vector<const char*> deviceExtensions, QueueFlagBits requiredQueues, VkSurfaceKHR surface = VK_NULL_HANDLE);
 
-    Device* CreateDevice(QueueFlagBits requiredQueues, VkPhysicalDeviceFeatures deviceFeatures);
+    // Optional device extensions: check the picked device has one, then enable it before CreateDevice
+    bool IsDeviceExtensionSupported(const char* extension) const;
+    void EnableDeviceExtension(const char* extension);
+    bool IsDeviceExtensionEnabled(const char* extension) const;
+
+    // Fills a chain of extension feature structs for the picked device, false if they can't be queried
+    bool GetDeviceFeatures(void* features) const;
+
+    // extensionFeatures is an optional chain of extension feature structs to enable
+    Device* CreateDevice(QueueFlagBits requiredQueues, VkPhysicalDeviceFeatures deviceFeatures, const void* extensionFeatures = nullptr);
 
     ~Instance();
 
@@ -43,4 +52,5 @@ private:
     std::vector<VkSurfaceFormatKHR> surfaceFormats;
     std::vector<VkPresentModeKHR> presentModes;
     VkPhysicalDeviceMemoryProperties deviceMemoryProperties;
+    bool hasPhysicalDeviceProperties2 = false;
 };
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <limits>
 #include "Renderer.h"
 #include "Instance.h"
 #include "ShaderModule.h"
@@ -5,6 +7,7 @@
 #include "Strand.h"
 #include "Camera.h"
 #include "Image.h"
+#include "BufferUtils.h"
 
 #define SHADOWMAP_WIDTH 1080
 #define SHADOWMAP_HEIGHT 720
@@ -13,17 +16,106 @@
 #define OPACITY_MAP_FORMAT VK_FORMAT_R8G8B8A8_UNORM
 #define SHADOWMAP_FILTER VK_FILTER_LINEAR
 
-static constexpr unsigned int WORKGROUP_SIZE = 32;
-
-Renderer::Renderer(Device* device, SwapChain* swapChain, Scene* scene, Camera* camera, Camera* shadowCamera)
+// Shader and workgroup size of each entry in COMPUTE_STAGE_NAMES
+static const std::array<const char*, NUM_COMPUTE_STAGES> COMPUTE_SHADERS = {
+    "shaders/compactAwake.comp.spv",
+    "shaders/integrate.comp.spv",
+    "shaders/gridBounds.comp.spv",
+    "shaders/gridAllocate.comp.spv",
+    "shaders/sortKeys.comp.spv",
+    "shaders/particleToGrid.comp.spv",
+    "shaders/gridNormalize.comp.spv",
+    "shaders/gridToParticle.comp.spv",
+    "shaders/gridRelease.comp.spv",
+    "shaders/interpolateStrands.comp.spv",
+    "shaders/packPositions.comp.spv",
+};
+// gridBounds needs a power of two, particleToGrid's shared table has room for 8 cells of 64 points and
+// gridNormalize and gridRelease run one workgroup per grid brick
+static constexpr std::array<uint32_t, NUM_COMPUTE_STAGES> COMPUTE_WORKGROUP_SIZES = { 64, 32, 256, 128, 128, 64, GRID_BRICK_CELLS, 128, GRID_BRICK_CELLS, 128, 128 };
+
+// particleToGrid with float atomics, when the device enabled VK_EXT_shader_atomic_float
+static const char* PARTICLE_TO_GRID_FLOAT_SHADER = "shaders/particleToGridFloat.comp.spv";
+
+// Integrate stage of hair using StrandSolver::WorkgroupPerStrand. Its workgroups hold as many whole strands
+// as fit in this many invocations, and at least one
+static const char* INTEGRATE_STRAND_GROUP_SHADER = "shaders/integrateStrandGroup.comp.spv";
+static constexpr uint32_t STRAND_GROUP_WORKGROUP_SIZE = 64;
+
+// Radix passes of the point sort. The histogram and scatter run a workgroup per tile of POINT_SORT_TILE keys,
+// the scan a single workgroup of a power of two invocations
+static const char* SORT_HISTOGRAM_SHADER = "shaders/sortHistogram.comp.spv";
+static const char* SORT_SCAN_SHADER = "shaders/sortScan.comp.spv";
+static const char* SORT_SCATTER_SHADER = "shaders/sortScatter.comp.spv";
+static constexpr uint32_t SORT_SCAN_WORKGROUP_SIZE = 256;
+
+// Culls the strands against the camera and the light at the start of every frame, one invocation per strand.
+// The workgroup size has to match local_size_x in the shader
+static const char* STRAND_CULL_SHADER = "shaders/cullStrands.comp.spv";
+static constexpr uint32_t STRAND_CULL_WORKGROUP_SIZE = 64;
+
+// Stages recorded and timed, the last one only packs positions for rendering
+static constexpr int NUM_ACTIVE_COMPUTE_STAGES = PACK_STRAND_POSITIONS ? NUM_COMPUTE_STAGES : NUM_COMPUTE_STAGES - 1;
+
+// Specialization constants of the hair shaders (shaders/hairStrands.glsl), laid out as Renderer::HairSpecialization
+static const std::array<VkSpecializationMapEntry, 3> HAIR_SPECIALIZATION_ENTRIES = {{
+    { 0, offsetof(Renderer::HairSpecialization, packedPositions), sizeof(VkBool32) },
+    { 1, offsetof(Renderer::HairSpecialization, numCurvePoints), sizeof(int32_t) },
+    { 5, offsetof(Renderer::HairSpecialization, packedPositionScale), sizeof(float) },
+}};
+
+// Specialization constants of the simulation stages (shaders/simulation.glsl)
+struct ComputeSpecialization {
+    uint32_t workgroupSize;
+    int32_t numCurvePoints;
+    int32_t ftlPasses;
+    VkBool32 floatGridAtomics;
+    VkBool32 sortGridPoints;
+    float packedPositionScale;
+};
+
+// Push constants of the simulation stages (shaders/simulation.glsl): the point sort pass, and the part of the
+// colliders' motion the substep being recorded covers
+struct SimulationPushConstants {
+    uint32_t sortPass;
+    float sweepBegin;
+    float sweepEnd;
+};
+
+Renderer::Renderer(Device* device, SwapChain* swapChain, Scene* scene, Camera* camera, Camera* shadowCamera, bool sortGridPoints)
   : device(device),
     logicalDevice(device->GetVkDevice()),
     swapChain(swapChain),
     scene(scene),
     camera(camera),
-	shadowCamera(shadowCamera) {
+	shadowCamera(shadowCamera),
+    sortGridPoints(sortGridPoints) {
+
+    // The curve point count is baked into the pipelines, so every hair has to use the same one
+    numCurvePoints = scene->GetHair().empty() ? DEFAULT_NUM_CURVE_POINTS : scene->GetHair()[0]->GetNumCurvePoints();
+    for (Hair* hair : scene->GetHair()) {
+        if (hair->GetNumCurvePoints() != numCurvePoints) {
+            throw std::runtime_error("Failed to create renderer, all hair must have the same number of curve points");
+        }
+    }
+
+    // Float grid sums need the extension enabled on the device, which main only does when the feature is there
+#ifdef VK_EXT_shader_atomic_float
+    floatGridAtomics = device->GetInstance()->IsDeviceExtensionEnabled(VK_EXT_SHADER_ATOMIC_FLOAT_EXTENSION_NAME);
+#endif
+
+    hairSpecialization.packedPositions = PACK_STRAND_POSITIONS ? VK_TRUE : VK_FALSE;
+    hairSpecialization.numCurvePoints = numCurvePoints;
+    hairSpecialization.packedPositionScale = PACKED_POSITION_SCALE;
+    hairSpecializationInfo.mapEntryCount = static_cast<uint32_t>(HAIR_SPECIALIZATION_ENTRIES.size());
+    hairSpecializationInfo.pMapEntries = HAIR_SPECIALIZATION_ENTRIES.data();
+    hairSpecializationInfo.dataSize = sizeof(HairSpecialization);
+    hairSpecializationInfo.pData = &hairSpecialization;
+
+    separateComputeFamily = device->GetQueueIndex(QueueFlags::Compute) != device->GetQueueIndex(QueueFlags::Graphics);
 
     CreateCommandPools();
+    CreateStrandPool();
 
     CreateRenderPass();
 	CreateShadowMapRenderPass();
@@ -50,8 +142,7 @@ Renderer::Renderer(Device* device, SwapChain* swapChain, Scene* scene, Camera* c
     CreateTextureDescriptorSets();
     CreateShadowCameraDescriptorSet();
     CreateHairDescriptorSets();
-	CreateOpacityMapHairDescriptorSets();
-	CreateOpacityMapDescriptorSets();
+	CreateOpacityMapDescriptorSet();
     CreateTimeDescriptorSet();
 	CreateCollidersDescriptorSets();
 	CreateGridDescriptorSets();
@@ -61,10 +152,15 @@ Renderer::Renderer(Device* device, SwapChain* swapChain, Scene* scene, Camera* c
 	CreateOpacityMapPipeline();
     CreateGraphicsPipeline();
     CreateHairPipeline();
+    CreateStrandCullPipeline();
     CreateComputePipeline();
+    CreateComputeQueryPool();
+    CreateSyncObjects();
+    TransferSimulationResources();
 
     RecordCommandBuffers();
     RecordComputeCommandBuffer();
+    RecordDrawSlotAcquires();
 }
 
 
@@ -89,6 +185,93 @@ void Renderer::CreateCommandPools() {
 }
 
 
+void Renderer::CreateStrandPool() {
+    // Every group is a whole number of strands at the same strand index in each of the pool's buffers, and its lod
+    // strands and neighbors follow the previous group's with the strand indices moved along by its first strand
+    std::vector<glm::vec4> positions;
+    std::vector<glm::vec4> velocities;
+    std::vector<uint32_t> lodStrands;
+    std::vector<LodNeighbor> lodNeighbors;
+    for (Hair* hair : scene->GetHair()) {
+        HairGroup group = {};
+        group.firstStrand = static_cast<uint32_t>(numPoolStrands);
+        group.numStrands = static_cast<uint32_t>(hair->GetNumStrands());
+        hairGroups.push_back(group);
+
+        positions.insert(positions.end(), hair->GetPositions().begin(), hair->GetPositions().end());
+        velocities.insert(velocities.end(), hair->GetVelocities().begin(), hair->GetVelocities().end());
+        for (uint32_t strand : hair->GetLodStrands()) {
+            lodStrands.push_back(group.firstStrand + strand);
+        }
+        for (LodNeighbor neighbor : hair->GetLodNeighbors()) {
+            neighbor.strand += group.firstStrand;
+            lodNeighbors.push_back(neighbor);
+        }
+        numPoolStrands += hair->GetNumStrands();
+    }
+
+    // Vulkan doesn't allow empty buffers, an empty pool still gets one strand's worth of each
+    const VkDeviceSize poolStrands = std::max(numPoolStrands, 1);
+    positions.resize(poolStrands * numCurvePoints);
+    velocities.resize(poolStrands * numCurvePoints);
+    lodStrands.resize(NUM_SIMULATION_LODS * poolStrands);
+    lodNeighbors.resize(NUM_SIMULATION_LODS * poolStrands * SIMULATION_LOD_NEIGHBORS);
+    if (hairGroups.empty()) {
+        hairGroups.push_back(HairGroup());
+    }
+
+    simulationPositionsSize = poolStrands * numCurvePoints * sizeof(glm::vec4);
+    sortKeysSize = 2 * poolStrands * (numCurvePoints - 1) * sizeof(uint32_t);
+    sortHistogramsSize = (poolStrands * (numCurvePoints - 1) + POINT_SORT_TILE - 1) / POINT_SORT_TILE * POINT_SORT_RADIX * sizeof(uint32_t);
+    lodSize = sizeof(SimulationLod) + hairGroups.size() * sizeof(SimulationLodGroup);
+    lodStrandsSize = lodStrands.size() * sizeof(uint32_t);
+    lodNeighborsSize = lodNeighbors.size() * sizeof(LodNeighbor);
+    awakeStrandsSize = sizeof(AwakeStrands) + poolStrands * sizeof(uint32_t);
+    restingStepsSize = poolStrands * sizeof(uint32_t);
+
+    BufferUtils::CreateBufferFromData(device, graphicsCommandPool, positions.data(), simulationPositionsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, simulationPositionsBuffer, simulationPositionsBufferMemory);
+    BufferUtils::CreateBufferFromData(device, graphicsCommandPool, velocities.data(), simulationPositionsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, simulationVelocitiesBuffer, simulationVelocitiesBufferMemory);
+
+    // Only ever written by the point sort
+    BufferUtils::CreateBuffer(device, sortKeysSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, sortKeysBuffer, sortKeysBufferMemory);
+    BufferUtils::CreateBuffer(device, sortKeysSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, sortedPointsBuffer, sortedPointsBufferMemory);
+    BufferUtils::CreateBuffer(device, sortHistogramsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, sortHistogramsBuffer, sortHistogramsBufferMemory);
+
+    // The levels are only ever written by the uniform upload, before the simulation reads them
+    BufferUtils::CreateBuffer(device, lodSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, lodBuffer, lodBufferMemory);
+    BufferUtils::CreateBufferFromData(device, graphicsCommandPool, lodStrands.data(), lodStrandsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, lodStrandsBuffer, lodStrandsBufferMemory);
+    BufferUtils::CreateBufferFromData(device, graphicsCommandPool, lodNeighbors.data(), lodNeighborsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, lodNeighborsBuffer, lodNeighborsBufferMemory);
+
+    // Every strand starts out moving. The awake strands are rebuilt from scratch each step
+    std::vector<uint32_t> restingSteps(poolStrands, 0);
+    BufferUtils::CreateBufferFromData(device, graphicsCommandPool, restingSteps.data(), restingStepsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, restingStepsBuffer, restingStepsBufferMemory);
+    BufferUtils::CreateBuffer(device, awakeStrandsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, awakeStrandsBuffer, awakeStrandsBufferMemory);
+
+    // What the hair passes draw from, the packed positions or the simulation's own
+    void* renderPositions = positions.data();
+    poolPositionsSize = simulationPositionsSize;
+    std::vector<uint32_t> packedPositions;
+    if (PACK_STRAND_POSITIONS) {
+        const uint32_t strandWords = PackedStrandWords(numCurvePoints);
+        packedPositions.resize(poolStrands * strandWords);
+        for (VkDeviceSize i = 0; i < poolStrands; ++i) {
+            PackStrandPositions(&positions[i * numCurvePoints], numCurvePoints, &packedPositions[i * strandWords]);
+        }
+        renderPositions = packedPositions.data();
+        poolPositionsSize = packedPositions.size() * sizeof(uint32_t);
+    }
+
+    // Every draw slot starts out with the generated strands, the simulation packs or copies over them when it steps
+    for (int slot = 0; slot < NUM_DRAW_SLOTS; ++slot) {
+        BufferUtils::CreateBufferFromData(device, graphicsCommandPool, renderPositions, poolPositionsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, poolPositionsBuffers[slot], poolPositionsBufferMemories[slot]);
+        BufferUtils::CreateBufferFromData(device, graphicsCommandPool, renderPositions, poolPositionsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, poolPrevPositionsBuffers[slot], poolPrevPositionsBufferMemories[slot]);
+    }
+
+    // Reset and filled by the cull pass before every draw that reads it
+    VkDeviceSize culledStrandsSize = sizeof(CulledStrands) + (VkDeviceSize)NUM_CULL_VIEWS * std::max(numPoolStrands, 1) * sizeof(uint32_t);
+    BufferUtils::CreateBuffer(device, culledStrandsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, culledStrandsBuffer, culledStrandsBufferMemory);
+}
+
 void Renderer::CreateRenderPass() {
     // Color buffer attachment represented by one of the images from the swap chain
     VkAttachmentDescription colorAttachment = {};
@@ -349,13 +532,7 @@ void Renderer::CreateTextureDescriptorSetLayout() {
 
 
 void Renderer::CreateHairDescriptorSetLayout() {
-	VkDescriptorSetLayoutBinding uboLayoutBinding = {};
-	uboLayoutBinding.binding = 0;
-	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	uboLayoutBinding.descriptorCount = 1;
-	uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-	uboLayoutBinding.pImmutableSamplers = nullptr;
-
+	// Binding 0 is unused, the pool strands are already in world space
 	VkDescriptorSetLayoutBinding samplerLayoutBinding = {};
 	samplerLayoutBinding.binding = 1;
 	samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
@@ -363,7 +540,35 @@ void Renderer::CreateHairDescriptorSetLayout() {
 	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 	samplerLayoutBinding.pImmutableSamplers = nullptr;
 
-	std::vector<VkDescriptorSetLayoutBinding> bindings = { uboLayoutBinding, samplerLayoutBinding };
+	// Time, for interpolating between the last two simulated states
+	VkDescriptorSetLayoutBinding timeLayoutBinding = {};
+	timeLayoutBinding.binding = 2;
+	timeLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	timeLayoutBinding.descriptorCount = 1;
+	timeLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+	timeLayoutBinding.pImmutableSamplers = nullptr;
+
+	// Pool render positions (packed or not) after and before the last substep, read per strand. The cull pass
+	// reads the time and positions too
+	VkDescriptorSetLayoutBinding positionsLayoutBinding = {};
+	positionsLayoutBinding.binding = 3;
+	positionsLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	positionsLayoutBinding.descriptorCount = 1;
+	positionsLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+	positionsLayoutBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding prevPositionsLayoutBinding = positionsLayoutBinding;
+	prevPositionsLayoutBinding.binding = 4;
+
+	// Culled pool strands, written by the cull pass and looked up by gl_VertexIndex in the hair passes
+	VkDescriptorSetLayoutBinding culledStrandsLayoutBinding = {};
+	culledStrandsLayoutBinding.binding = 5;
+	culledStrandsLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	culledStrandsLayoutBinding.descriptorCount = 1;
+	culledStrandsLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+	culledStrandsLayoutBinding.pImmutableSamplers = nullptr;
+
+	std::vector<VkDescriptorSetLayoutBinding> bindings = { samplerLayoutBinding, timeLayoutBinding, positionsLayoutBinding, prevPositionsLayoutBinding, culledStrandsLayoutBinding };
 
 	// Create the descriptor set layout
 	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
@@ -424,14 +629,21 @@ void Renderer::CreateTimeDescriptorSetLayout() {
 
 void Renderer::CreateCollidersDescriptorSetLayout() {
 	// Describe the binding of the descriptor set layout
-	VkDescriptorSetLayoutBinding uboLayoutBinding = {};
-	uboLayoutBinding.binding = 0;
-	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	uboLayoutBinding.descriptorCount = 1;
-	uboLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-	uboLayoutBinding.pImmutableSamplers = nullptr;
-
-	std::vector<VkDescriptorSetLayoutBinding> bindings = { uboLayoutBinding };
+	VkDescriptorSetLayoutBinding collidersLayoutBinding = {};
+	collidersLayoutBinding.binding = 0;
+	collidersLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	collidersLayoutBinding.descriptorCount = 1;
+	collidersLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	collidersLayoutBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding sdfLayoutBinding = {};
+	sdfLayoutBinding.binding = 1;
+	sdfLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	sdfLayoutBinding.descriptorCount = 1;
+	sdfLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	sdfLayoutBinding.pImmutableSamplers = nullptr;
+
+	std::vector<VkDescriptorSetLayoutBinding> bindings = { collidersLayoutBinding, sdfLayoutBinding };
 
 	// Create the descriptor set layout
 	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
@@ -453,7 +665,36 @@ void Renderer::CreateGridDescriptorSetLayout() {
 	gridValuesLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 	gridValuesLayoutBinding.pImmutableSamplers = nullptr;
 
-	std::vector<VkDescriptorSetLayoutBinding> bindings = { gridValuesLayoutBinding };
+	VkDescriptorSetLayoutBinding gridVelocityLayoutBinding = {};
+	gridVelocityLayoutBinding.binding = 1;
+	gridVelocityLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	gridVelocityLayoutBinding.descriptorCount = 1;
+	gridVelocityLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	gridVelocityLayoutBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding gridBricksLayoutBinding = {};
+	gridBricksLayoutBinding.binding = 2;
+	gridBricksLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	gridBricksLayoutBinding.descriptorCount = 1;
+	gridBricksLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	gridBricksLayoutBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding gridBoundsLayoutBinding = {};
+	gridBoundsLayoutBinding.binding = 3;
+	gridBoundsLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	gridBoundsLayoutBinding.descriptorCount = 1;
+	gridBoundsLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	gridBoundsLayoutBinding.pImmutableSamplers = nullptr;
+
+	// The grid velocity image again, sampled by gridToParticle
+	VkDescriptorSetLayoutBinding gridVelocitySamplerLayoutBinding = {};
+	gridVelocitySamplerLayoutBinding.binding = 4;
+	gridVelocitySamplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	gridVelocitySamplerLayoutBinding.descriptorCount = 1;
+	gridVelocitySamplerLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	gridVelocitySamplerLayoutBinding.pImmutableSamplers = nullptr;
+
+	std::vector<VkDescriptorSetLayoutBinding> bindings = { gridValuesLayoutBinding, gridVelocityLayoutBinding, gridBricksLayoutBinding, gridBoundsLayoutBinding, gridVelocitySamplerLayoutBinding };
 
 	// Create the descriptor set layout
 	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
@@ -475,15 +716,44 @@ void Renderer::CreateComputeDescriptorSetLayout() {
 	strandsPosLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 	strandsPosLayoutBinding.pImmutableSamplers = nullptr;
 
-	// TODO: Add more bindings if needed (ex. culled strands, num strands)
-	VkDescriptorSetLayoutBinding numStrandsLayoutBinding = {};
-	numStrandsLayoutBinding.binding = 1;
-	numStrandsLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	numStrandsLayoutBinding.descriptorCount = 1;
-	numStrandsLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
-	numStrandsLayoutBinding.pImmutableSamplers = nullptr;
+	VkDescriptorSetLayoutBinding strandsVelLayoutBinding = {};
+	strandsVelLayoutBinding.binding = 2;
+	strandsVelLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	strandsVelLayoutBinding.descriptorCount = 1;
+	strandsVelLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	strandsVelLayoutBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding packedPosLayoutBinding = {};
+	packedPosLayoutBinding.binding = 3;
+	packedPosLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	packedPosLayoutBinding.descriptorCount = 1;
+	packedPosLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	packedPosLayoutBinding.pImmutableSamplers = nullptr;
+
+	// Point sort keys, sorted points and digit counts
+	std::array<VkDescriptorSetLayoutBinding, 3> sortLayoutBindings = {};
+	for (uint32_t i = 0; i < sortLayoutBindings.size(); ++i) {
+		sortLayoutBindings[i].binding = 4 + i;
+		sortLayoutBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		sortLayoutBindings[i].descriptorCount = 1;
+		sortLayoutBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		sortLayoutBindings[i].pImmutableSamplers = nullptr;
+	}
+
+	// Simulation LOD level, its guides and the guides each strand follows, then the awake guides and the steps
+	// each strand has been calm for
+	std::array<VkDescriptorSetLayoutBinding, 5> lodLayoutBindings = {};
+	for (uint32_t i = 0; i < lodLayoutBindings.size(); ++i) {
+		lodLayoutBindings[i].binding = 7 + i;
+		lodLayoutBindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		lodLayoutBindings[i].descriptorCount = 1;
+		lodLayoutBindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+		lodLayoutBindings[i].pImmutableSamplers = nullptr;
+	}
 
-	std::vector<VkDescriptorSetLayoutBinding> bindings = { strandsPosLayoutBinding, numStrandsLayoutBinding };
+	std::vector<VkDescriptorSetLayoutBinding> bindings = { strandsPosLayoutBinding, strandsVelLayoutBinding, packedPosLayoutBinding };
+	bindings.insert(bindings.end(), sortLayoutBindings.begin(), sortLayoutBindings.end());
+	bindings.insert(bindings.end(), lodLayoutBindings.begin(), lodLayoutBindings.end());
 
 	// Create the descriptor set layout
 	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
@@ -503,23 +773,31 @@ void Renderer::CreateDescriptorPool() {
         // Camera
         { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , 2},
 
-        // Models + Strands
-        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER , static_cast<uint32_t>(1 + 2 * scene->GetModels().size() + scene->GetHair().size()) },
+        // Models + opacity map + the hair set of each draw slot
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER , static_cast<uint32_t>(2 + 2 * scene->GetModels().size() + NUM_DRAW_SLOTS) },
 
-        // Models + Strands
-        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , static_cast<uint32_t>(2 * scene->GetModels().size() + scene->GetHair().size()) },
+        // Models
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , static_cast<uint32_t>(2 * scene->GetModels().size()) },
 
-        // Time (compute)
-        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , 1 },
+        // Time (compute + hair vertex interpolation)
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , static_cast<uint32_t>(1 + NUM_DRAW_SLOTS) },
 
-		// Hair (compute)
-		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER , static_cast<uint32_t>(scene->GetHair().size()) },
+		// Pool positions + velocities + packed render positions + point sort keys, points and counts + LOD levels,
+		// strands and neighbors + awake strands and resting steps, for the current and previous render positions of
+		// each draw slot (compute)
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER , static_cast<uint32_t>(11 * 2 * NUM_DRAW_SLOTS) },
 
-		// Collision objects (compute)
-		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , 1 },
+		// Pool render positions + previous render positions + culled strands of each draw slot's hair set
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER , static_cast<uint32_t>(3 * NUM_DRAW_SLOTS) },
 
-		// Grid (compute)
-		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER , 2 },
+		// Collision objects and the SDF collider (compute)
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER , 1 },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER , 1 },
+
+		// Grid cells + bricks + bounds, and velocities as a storage image and a sampled one (compute)
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER , 3 },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE , 1 },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER , 1 },
 
 		// Model Matrices dynamic
 		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1 },
@@ -529,7 +807,9 @@ void Renderer::CreateDescriptorPool() {
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
     poolInfo.pPoolSizes = poolSizes.data();
-    poolInfo.maxSets = 12; // TODO: idk what determines this number
+    // Camera, model, shadow camera, time, colliders, grid and opacity map sets, a texture set per model, and a hair
+    // set and two compute sets per draw slot
+    poolInfo.maxSets = static_cast<uint32_t>(7 + scene->GetModels().size() + 3 * NUM_DRAW_SLOTS);
 
     if (vkCreateDescriptorPool(logicalDevice, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create descriptor pool");
@@ -686,52 +966,101 @@ void Renderer::CreateTextureDescriptorSets() {
 
 
 void Renderer::CreateHairDescriptorSets() {
-	hairDescriptorSets.resize(scene->GetHair().size());
+	// One set per draw slot, sets[slot] reads the slot's pool positions of every hair group
+	hairDescriptorSets.resize(NUM_DRAW_SLOTS);
 
 	// Describe the desciptor set
-	VkDescriptorSetLayout layouts[] = { hairDescriptorSetLayout };
+	std::vector<VkDescriptorSetLayout> layouts(hairDescriptorSets.size(), hairDescriptorSetLayout);
 	VkDescriptorSetAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocInfo.descriptorPool = descriptorPool;
 	allocInfo.descriptorSetCount = static_cast<uint32_t>(hairDescriptorSets.size());
-	allocInfo.pSetLayouts = layouts;
+	allocInfo.pSetLayouts = layouts.data();
 
 	// Allocate descriptor sets
 	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, hairDescriptorSets.data()) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to allocate descriptor set");
 	}
 
-	std::vector<VkWriteDescriptorSet> descriptorWrites(2 * hairDescriptorSets.size());
-
-	for (uint32_t i = 0; i < scene->GetHair().size(); ++i) {
-		VkDescriptorBufferInfo hairBufferInfo = {};
-		hairBufferInfo.buffer = scene->GetHair()[i]->GetModelBuffer();
-		hairBufferInfo.offset = 0;
-		hairBufferInfo.range = sizeof(ModelBufferObject);
-
-		// Bind image and sampler resources to the descriptor
-		VkDescriptorImageInfo imageInfo = {};
-		imageInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
-		imageInfo.imageView = shadowMapImageView;
-		imageInfo.sampler = shadowMapSampler;
-
-		descriptorWrites[2 * i + 0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[2 * i + 0].dstSet = hairDescriptorSets[i];
-		descriptorWrites[2 * i + 0].dstBinding = 0;
-		descriptorWrites[2 * i + 0].dstArrayElement = 0;
-		descriptorWrites[2 * i + 0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		descriptorWrites[2 * i + 0].descriptorCount = 1;
-		descriptorWrites[2 * i + 0].pBufferInfo = &hairBufferInfo;
-		descriptorWrites[2 * i + 0].pImageInfo = nullptr;
-		descriptorWrites[2 * i + 0].pTexelBufferView = nullptr;
-
-		descriptorWrites[2 * i + 1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[2 * i + 1].dstSet = hairDescriptorSets[i];
-		descriptorWrites[2 * i + 1].dstBinding = 1;
-		descriptorWrites[2 * i + 1].dstArrayElement = 0;
-		descriptorWrites[2 * i + 1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		descriptorWrites[2 * i + 1].descriptorCount = 1;
-		descriptorWrites[2 * i + 1].pImageInfo = &imageInfo;
+	std::vector<VkWriteDescriptorSet> descriptorWrites(5 * hairDescriptorSets.size());
+	std::vector<VkDescriptorBufferInfo> positionsBufferInfos(hairDescriptorSets.size());
+	std::vector<VkDescriptorBufferInfo> prevPositionsBufferInfos(hairDescriptorSets.size());
+
+	// Bind image and sampler resources to the descriptor
+	VkDescriptorImageInfo imageInfo = {};
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+	imageInfo.imageView = shadowMapImageView;
+	imageInfo.sampler = shadowMapSampler;
+
+	VkDescriptorBufferInfo timeBufferInfo = {};
+	timeBufferInfo.buffer = scene->GetRenderTimeBuffer();
+	timeBufferInfo.offset = 0;
+	timeBufferInfo.range = sizeof(Time);
+
+	// The culled strands are the same in every slot
+	VkDescriptorBufferInfo culledStrandsBufferInfo = {};
+	culledStrandsBufferInfo.buffer = culledStrandsBuffer;
+	culledStrandsBufferInfo.offset = 0;
+	culledStrandsBufferInfo.range = VK_WHOLE_SIZE;
+
+	for (uint32_t slot = 0; slot < hairDescriptorSets.size(); ++slot) {
+		descriptorWrites[5 * slot + 0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[5 * slot + 0].dstSet = hairDescriptorSets[slot];
+		descriptorWrites[5 * slot + 0].dstBinding = 1;
+		descriptorWrites[5 * slot + 0].dstArrayElement = 0;
+		descriptorWrites[5 * slot + 0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+		descriptorWrites[5 * slot + 0].descriptorCount = 1;
+		descriptorWrites[5 * slot + 0].pImageInfo = &imageInfo;
+
+		descriptorWrites[5 * slot + 1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[5 * slot + 1].dstSet = hairDescriptorSets[slot];
+		descriptorWrites[5 * slot + 1].dstBinding = 2;
+		descriptorWrites[5 * slot + 1].dstArrayElement = 0;
+		descriptorWrites[5 * slot + 1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		descriptorWrites[5 * slot + 1].descriptorCount = 1;
+		descriptorWrites[5 * slot + 1].pBufferInfo = &timeBufferInfo;
+		descriptorWrites[5 * slot + 1].pImageInfo = nullptr;
+		descriptorWrites[5 * slot + 1].pTexelBufferView = nullptr;
+
+		VkDescriptorBufferInfo& positionsBufferInfo = positionsBufferInfos[slot];
+		positionsBufferInfo.buffer = poolPositionsBuffers[slot];
+		positionsBufferInfo.offset = 0;
+		positionsBufferInfo.range = poolPositionsSize;
+
+		VkDescriptorBufferInfo& prevPositionsBufferInfo = prevPositionsBufferInfos[slot];
+		prevPositionsBufferInfo.buffer = poolPrevPositionsBuffers[slot];
+		prevPositionsBufferInfo.offset = 0;
+		prevPositionsBufferInfo.range = poolPositionsSize;
+
+		descriptorWrites[5 * slot + 2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[5 * slot + 2].dstSet = hairDescriptorSets[slot];
+		descriptorWrites[5 * slot + 2].dstBinding = 3;
+		descriptorWrites[5 * slot + 2].dstArrayElement = 0;
+		descriptorWrites[5 * slot + 2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[5 * slot + 2].descriptorCount = 1;
+		descriptorWrites[5 * slot + 2].pBufferInfo = &positionsBufferInfo;
+		descriptorWrites[5 * slot + 2].pImageInfo = nullptr;
+		descriptorWrites[5 * slot + 2].pTexelBufferView = nullptr;
+
+		descriptorWrites[5 * slot + 3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[5 * slot + 3].dstSet = hairDescriptorSets[slot];
+		descriptorWrites[5 * slot + 3].dstBinding = 4;
+		descriptorWrites[5 * slot + 3].dstArrayElement = 0;
+		descriptorWrites[5 * slot + 3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[5 * slot + 3].descriptorCount = 1;
+		descriptorWrites[5 * slot + 3].pBufferInfo = &prevPositionsBufferInfo;
+		descriptorWrites[5 * slot + 3].pImageInfo = nullptr;
+		descriptorWrites[5 * slot + 3].pTexelBufferView = nullptr;
+
+		descriptorWrites[5 * slot + 4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[5 * slot + 4].dstSet = hairDescriptorSets[slot];
+		descriptorWrites[5 * slot + 4].dstBinding = 5;
+		descriptorWrites[5 * slot + 4].dstArrayElement = 0;
+		descriptorWrites[5 * slot + 4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[5 * slot + 4].descriptorCount = 1;
+		descriptorWrites[5 * slot + 4].pBufferInfo = &culledStrandsBufferInfo;
+		descriptorWrites[5 * slot + 4].pImageInfo = nullptr;
+		descriptorWrites[5 * slot + 4].pTexelBufferView = nullptr;
 	}
 
 	// Update descriptor sets
@@ -739,97 +1068,37 @@ void Renderer::CreateHairDescriptorSets() {
 }
 
 
-void Renderer::CreateOpacityMapDescriptorSets() {
-	opacityMapDescriptorSets.resize(scene->GetHair().size());
-
+void Renderer::CreateOpacityMapDescriptorSet() {
 	// Describe the desciptor set
 	VkDescriptorSetLayout layouts[] = { opacityMapDescriptorSetLayout };
 	VkDescriptorSetAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocInfo.descriptorPool = descriptorPool;
-	allocInfo.descriptorSetCount = static_cast<uint32_t>(opacityMapDescriptorSets.size());
-	allocInfo.pSetLayouts = layouts;
-
-	// Allocate descriptor sets
-	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, opacityMapDescriptorSets.data()) != VK_SUCCESS) {
-		throw std::runtime_error("Failed to allocate descriptor set");
-	}
-
-	std::vector<VkWriteDescriptorSet> descriptorWrites(opacityMapDescriptorSets.size());
-
-	for (uint32_t i = 0; i < scene->GetHair().size(); ++i) {
-		// Bind image and sampler resources to the descriptor
-		VkDescriptorImageInfo imageInfo = {};
-		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL; // VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
-		imageInfo.imageView = opacityMapImageView;
-		imageInfo.sampler = opacityMapSampler;
-
-		descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[i].dstSet = opacityMapDescriptorSets[i];
-		descriptorWrites[i].dstBinding = 0;
-		descriptorWrites[i].dstArrayElement = 0;
-		descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		descriptorWrites[i].descriptorCount = 1;
-		descriptorWrites[i].pImageInfo = &imageInfo;
-	}
-
-	// Update descriptor sets
-	vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
-}
-
-void Renderer::CreateOpacityMapHairDescriptorSets() {
-	// TODO: Create Descriptor sets for the hair.
-	// This should involve creating descriptor sets which point to the model matrix of each group of hair
-	opacityMapHairDescriptorSets.resize(scene->GetHair().size());
-
-	// Describe the desciptor set
-	VkDescriptorSetLayout layouts[] = { hairDescriptorSetLayout };
-	VkDescriptorSetAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-	allocInfo.descriptorPool = descriptorPool;
-	allocInfo.descriptorSetCount = static_cast<uint32_t>(opacityMapHairDescriptorSets.size());
+	allocInfo.descriptorSetCount = 1;
 	allocInfo.pSetLayouts = layouts;
 
 	// Allocate descriptor sets
-	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, opacityMapHairDescriptorSets.data()) != VK_SUCCESS) {
+	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, &opacityMapDescriptorSet) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to allocate descriptor set");
 	}
 
-	std::vector<VkWriteDescriptorSet> descriptorWrites(2 * opacityMapHairDescriptorSets.size());
-
-	for (uint32_t i = 0; i < scene->GetHair().size(); ++i) {
-		VkDescriptorBufferInfo hairBufferInfo = {};
-		hairBufferInfo.buffer = scene->GetHair()[i]->GetModelBuffer();
-		hairBufferInfo.offset = 0;
-		hairBufferInfo.range = sizeof(ModelBufferObject);
-
-		// Bind image and sampler resources to the descriptor
-		VkDescriptorImageInfo imageInfo = {};
-		imageInfo.imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
-		imageInfo.imageView = shadowMapImageView;
-		imageInfo.sampler = shadowMapSampler;
-
-		descriptorWrites[2 * i + 0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[2 * i + 0].dstSet = opacityMapHairDescriptorSets[i];
-		descriptorWrites[2 * i + 0].dstBinding = 0;
-		descriptorWrites[2 * i + 0].dstArrayElement = 0;
-		descriptorWrites[2 * i + 0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		descriptorWrites[2 * i + 0].descriptorCount = 1;
-		descriptorWrites[2 * i + 0].pBufferInfo = &hairBufferInfo;
-		descriptorWrites[2 * i + 0].pImageInfo = nullptr;
-		descriptorWrites[2 * i + 0].pTexelBufferView = nullptr;
-
-		descriptorWrites[2 * i + 1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[2 * i + 1].dstSet = opacityMapHairDescriptorSets[i];
-		descriptorWrites[2 * i + 1].dstBinding = 1;
-		descriptorWrites[2 * i + 1].dstArrayElement = 0;
-		descriptorWrites[2 * i + 1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-		descriptorWrites[2 * i + 1].descriptorCount = 1;
-		descriptorWrites[2 * i + 1].pImageInfo = &imageInfo;
-	}
+	// Bind image and sampler resources to the descriptor
+	VkDescriptorImageInfo imageInfo = {};
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL; // VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+	imageInfo.imageView = opacityMapImageView;
+	imageInfo.sampler = opacityMapSampler;
+
+	VkWriteDescriptorSet descriptorWrite = {};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = opacityMapDescriptorSet;
+	descriptorWrite.dstBinding = 0;
+	descriptorWrite.dstArrayElement = 0;
+	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.pImageInfo = &imageInfo;
 
 	// Update descriptor sets
-	vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+	vkUpdateDescriptorSets(logicalDevice, 1, &descriptorWrite, 0, nullptr);
 }
 
 
@@ -887,19 +1156,34 @@ void Renderer::CreateCollidersDescriptorSets() {
 	VkDescriptorBufferInfo colliderBufferInfo = {};
 	colliderBufferInfo.buffer = scene->GetCollidersBuffer();
 	colliderBufferInfo.offset = 0;
-	colliderBufferInfo.range = scene->GetColliders().size() * sizeof(Collider);
+	colliderBufferInfo.range = scene->GetCollidersBufferSize();
 
-	std::array<VkWriteDescriptorSet, 1> descriptorWrites = {};
+	VkDescriptorImageInfo sdfImageInfo = {};
+	sdfImageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	sdfImageInfo.imageView = scene->GetSdfImageView();
+	sdfImageInfo.sampler = scene->GetSdfSampler();
+
+	std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
 	descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 	descriptorWrites[0].dstSet = collidersDescriptorSets;
 	descriptorWrites[0].dstBinding = 0;
 	descriptorWrites[0].dstArrayElement = 0;
-	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 	descriptorWrites[0].descriptorCount = 1;
 	descriptorWrites[0].pBufferInfo = &colliderBufferInfo;
 	descriptorWrites[0].pImageInfo = nullptr;
 	descriptorWrites[0].pTexelBufferView = nullptr;
 
+	descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrites[1].dstSet = collidersDescriptorSets;
+	descriptorWrites[1].dstBinding = 1;
+	descriptorWrites[1].dstArrayElement = 0;
+	descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	descriptorWrites[1].descriptorCount = 1;
+	descriptorWrites[1].pBufferInfo = nullptr;
+	descriptorWrites[1].pImageInfo = &sdfImageInfo;
+	descriptorWrites[1].pTexelBufferView = nullptr;
+
 	// Update descriptor sets
 	vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 }
@@ -925,7 +1209,27 @@ void Renderer::CreateGridDescriptorSets() {
 	gridBufferInfo.offset = 0;
 	gridBufferInfo.range = scene->GetGrid().size() * sizeof(GridCell);
 
-	std::array<VkWriteDescriptorSet, 1> descriptorWrites = {};
+	VkDescriptorImageInfo gridVelocityImageInfo = {};
+	gridVelocityImageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+	gridVelocityImageInfo.imageView = scene->GetGridVelocityImageView();
+	gridVelocityImageInfo.sampler = VK_NULL_HANDLE;
+
+	VkDescriptorImageInfo gridVelocitySamplerInfo = {};
+	gridVelocitySamplerInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+	gridVelocitySamplerInfo.imageView = scene->GetGridVelocityImageView();
+	gridVelocitySamplerInfo.sampler = scene->GetGridVelocitySampler();
+
+	VkDescriptorBufferInfo gridBricksBufferInfo = {};
+	gridBricksBufferInfo.buffer = scene->GetGridBricksBuffer();
+	gridBricksBufferInfo.offset = 0;
+	gridBricksBufferInfo.range = sizeof(GridBricks);
+
+	VkDescriptorBufferInfo gridBoundsBufferInfo = {};
+	gridBoundsBufferInfo.buffer = scene->GetGridBoundsBuffer();
+	gridBoundsBufferInfo.offset = 0;
+	gridBoundsBufferInfo.range = sizeof(GridBounds);
+
+	std::array<VkWriteDescriptorSet, 5> descriptorWrites = {};
 	descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 	descriptorWrites[0].dstSet = gridDescriptorSets;
 	descriptorWrites[0].dstBinding = 0;
@@ -936,60 +1240,111 @@ void Renderer::CreateGridDescriptorSets() {
 	descriptorWrites[0].pImageInfo = nullptr;
 	descriptorWrites[0].pTexelBufferView = nullptr;
 
+	descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrites[1].dstSet = gridDescriptorSets;
+	descriptorWrites[1].dstBinding = 1;
+	descriptorWrites[1].dstArrayElement = 0;
+	descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	descriptorWrites[1].descriptorCount = 1;
+	descriptorWrites[1].pBufferInfo = nullptr;
+	descriptorWrites[1].pImageInfo = &gridVelocityImageInfo;
+	descriptorWrites[1].pTexelBufferView = nullptr;
+
+	descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrites[2].dstSet = gridDescriptorSets;
+	descriptorWrites[2].dstBinding = 2;
+	descriptorWrites[2].dstArrayElement = 0;
+	descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	descriptorWrites[2].descriptorCount = 1;
+	descriptorWrites[2].pBufferInfo = &gridBricksBufferInfo;
+	descriptorWrites[2].pImageInfo = nullptr;
+	descriptorWrites[2].pTexelBufferView = nullptr;
+
+	descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrites[3].dstSet = gridDescriptorSets;
+	descriptorWrites[3].dstBinding = 3;
+	descriptorWrites[3].dstArrayElement = 0;
+	descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	descriptorWrites[3].descriptorCount = 1;
+	descriptorWrites[3].pBufferInfo = &gridBoundsBufferInfo;
+	descriptorWrites[3].pImageInfo = nullptr;
+	descriptorWrites[3].pTexelBufferView = nullptr;
+
+	descriptorWrites[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrites[4].dstSet = gridDescriptorSets;
+	descriptorWrites[4].dstBinding = 4;
+	descriptorWrites[4].dstArrayElement = 0;
+	descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	descriptorWrites[4].descriptorCount = 1;
+	descriptorWrites[4].pBufferInfo = nullptr;
+	descriptorWrites[4].pImageInfo = &gridVelocitySamplerInfo;
+	descriptorWrites[4].pTexelBufferView = nullptr;
+
 	// Update descriptor sets
 	vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 }
 
 
 void Renderer::CreateComputeDescriptorSets() {   
-	computeDescriptorSets.resize(scene->GetHair().size());
-
-	// Describe the desciptor set
-	VkDescriptorSetLayout layouts[] = { computeDescriptorSetLayout };
+	// Two sets per draw slot, packPositions writing its render positions or its previous ones
+	std::array<VkDescriptorSetLayout, 2 * NUM_DRAW_SLOTS> layouts;
+	layouts.fill(computeDescriptorSetLayout);
 	VkDescriptorSetAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocInfo.descriptorPool = descriptorPool;
-	allocInfo.descriptorSetCount = static_cast<uint32_t>(computeDescriptorSets.size());
-	allocInfo.pSetLayouts = layouts;
+	allocInfo.descriptorSetCount = static_cast<uint32_t>(layouts.size());
+	allocInfo.pSetLayouts = layouts.data();
 
 	// Allocate descriptor sets
-	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, computeDescriptorSets.data()) != VK_SUCCESS) {
+	std::array<VkDescriptorSet, 2 * NUM_DRAW_SLOTS> sets;
+	if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, sets.data()) != VK_SUCCESS) {
 		throw std::runtime_error("Failed to allocate descriptor set");
 	}
+	for (int slot = 0; slot < NUM_DRAW_SLOTS; ++slot) {
+		computeDescriptorSets[slot] = sets[2 * slot];
+		prevComputeDescriptorSets[slot] = sets[2 * slot + 1];
+	}
 
-	int numBuffers = 2; // TODO: set to number of buffers to compute (input, num)
-	std::vector<VkWriteDescriptorSet> descriptorWrites(numBuffers * computeDescriptorSets.size()); 
-
-	for (uint32_t i = 0; i < scene->GetHair().size(); ++i) {
-		VkDescriptorBufferInfo hairBufferInfo = {};
-		hairBufferInfo.buffer = scene->GetHair()[i]->GetStrandsBuffer();
-		hairBufferInfo.offset = 0;
-		hairBufferInfo.range = scene->GetHair()[i]->GetNumStrands() * sizeof(Strand);
-
-		VkDescriptorBufferInfo numStrandsBufferInfo = {};
-		numStrandsBufferInfo.buffer = scene->GetHair()[i]->GetNumStrandsBuffer();
-		numStrandsBufferInfo.offset = 0;
-		numStrandsBufferInfo.range = sizeof(StrandDrawIndirect);
-
-		descriptorWrites[numBuffers * i + 0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[numBuffers * i + 0].dstSet = computeDescriptorSets[i];
-		descriptorWrites[numBuffers * i + 0].dstBinding = 0;
-		descriptorWrites[numBuffers * i + 0].dstArrayElement = 0;
-		descriptorWrites[numBuffers * i + 0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		descriptorWrites[numBuffers * i + 0].descriptorCount = 1;
-		descriptorWrites[numBuffers * i + 0].pBufferInfo = &hairBufferInfo;
-		descriptorWrites[numBuffers * i + 0].pImageInfo = nullptr;
-		descriptorWrites[numBuffers * i + 0].pTexelBufferView = nullptr;
-
-		descriptorWrites[numBuffers * i + 1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[numBuffers * i + 1].dstSet = computeDescriptorSets[i];
-		descriptorWrites[numBuffers * i + 1].dstBinding = 1;
-		descriptorWrites[numBuffers * i + 1].dstArrayElement = 0;
-		descriptorWrites[numBuffers * i + 1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		descriptorWrites[numBuffers * i + 1].descriptorCount = 1;
-		descriptorWrites[numBuffers * i + 1].pBufferInfo = &numStrandsBufferInfo;
-		descriptorWrites[numBuffers * i + 1].pImageInfo = nullptr;
-		descriptorWrites[numBuffers * i + 1].pTexelBufferView = nullptr;
+	// positions, velocities, the point sort buffers and the LOD buffers, the same for every set
+	std::vector<uint32_t> bindings = { 0, 2 };
+	std::vector<VkDescriptorBufferInfo> bufferInfos = {
+		{ simulationPositionsBuffer, 0, simulationPositionsSize },
+		{ simulationVelocitiesBuffer, 0, simulationPositionsSize },
+		{ sortKeysBuffer, 0, sortKeysSize },
+		{ sortedPointsBuffer, 0, sortKeysSize },
+		{ sortHistogramsBuffer, 0, sortHistogramsSize },
+		{ lodBuffer, 0, lodSize },
+		{ lodStrandsBuffer, 0, lodStrandsSize },
+		{ lodNeighborsBuffer, 0, lodNeighborsSize },
+		{ awakeStrandsBuffer, 0, awakeStrandsSize },
+		{ restingStepsBuffer, 0, restingStepsSize },
+	};
+	for (uint32_t binding = 4; binding < 12; ++binding) {
+		bindings.push_back(binding);
+	}
+
+	// Then the packed render positions if they're used
+	std::vector<VkDescriptorBufferInfo> packedBufferInfos;
+	for (int slot = 0; slot < NUM_DRAW_SLOTS; ++slot) {
+		packedBufferInfos.push_back({ poolPositionsBuffers[slot], 0, poolPositionsSize });
+		packedBufferInfos.push_back({ poolPrevPositionsBuffers[slot], 0, poolPositionsSize });
+	}
+
+	std::vector<VkWriteDescriptorSet> descriptorWrites;
+	for (size_t j = 0; j < sets.size(); ++j) {
+		for (size_t i = 0; i < bindings.size() + (PACK_STRAND_POSITIONS ? 1 : 0); ++i) {
+			VkWriteDescriptorSet descriptorWrite = {};
+			descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrite.dstSet = sets[j];
+			descriptorWrite.dstBinding = i < bindings.size() ? bindings[i] : 3;
+			descriptorWrite.dstArrayElement = 0;
+			descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrite.descriptorCount = 1;
+			descriptorWrite.pBufferInfo = i < bindings.size() ? &bufferInfos[i] : &packedBufferInfos[j];
+			descriptorWrite.pImageInfo = nullptr;
+			descriptorWrite.pTexelBufferView = nullptr;
+			descriptorWrites.push_back(descriptorWrite);
+		}
 	}
 
 	// Update descriptor sets
@@ -1170,6 +1525,7 @@ void Renderer::CreateShadowMapPipeline() {
 	vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
 	vertShaderStageInfo.module = vertShaderModule;
 	vertShaderStageInfo.pName = "main";
+	vertShaderStageInfo.pSpecializationInfo = &hairSpecializationInfo;
 
 	VkPipelineShaderStageCreateInfo tescShaderStageInfo = {};
 	tescShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -1182,6 +1538,7 @@ void Renderer::CreateShadowMapPipeline() {
 	teseShaderStageInfo.stage = VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
 	teseShaderStageInfo.module = teseShaderModule;
 	teseShaderStageInfo.pName = "main";
+	teseShaderStageInfo.pSpecializationInfo = &hairSpecializationInfo;
 
 	VkPipelineShaderStageCreateInfo geomShaderStageInfo = {};
 	geomShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -1197,13 +1554,11 @@ void Renderer::CreateShadowMapPipeline() {
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
 	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 
-	auto bindingDescription = Strand::getBindingDescription();
-	auto attributeDescriptions = Strand::getAttributeDescriptions();
-
-	vertexInputInfo.vertexBindingDescriptionCount = 1;
-	vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-	vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+	// No vertex buffers: one vertex per strand, the shaders fetch its curve points by gl_VertexIndex
+	vertexInputInfo.vertexBindingDescriptionCount = 0;
+	vertexInputInfo.pVertexBindingDescriptions = nullptr;
+	vertexInputInfo.vertexAttributeDescriptionCount = 0;
+	vertexInputInfo.pVertexAttributeDescriptions = nullptr;
 
 	// Input Assembly
 	VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
@@ -1365,6 +1720,7 @@ void Renderer::CreateOpacityMapPipeline() {
 	vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
 	vertShaderStageInfo.module = vertShaderModule;
 	vertShaderStageInfo.pName = "main";
+	vertShaderStageInfo.pSpecializationInfo = &hairSpecializationInfo;
 
 	VkPipelineShaderStageCreateInfo tescShaderStageInfo = {};
 	tescShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -1377,6 +1733,7 @@ void Renderer::CreateOpacityMapPipeline() {
 	teseShaderStageInfo.stage = VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
 	teseShaderStageInfo.module = teseShaderModule;
 	teseShaderStageInfo.pName = "main";
+	teseShaderStageInfo.pSpecializationInfo = &hairSpecializationInfo;
 
 	VkPipelineShaderStageCreateInfo geomShaderStageInfo = {};
 	geomShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -1398,13 +1755,11 @@ void Renderer::CreateOpacityMapPipeline() {
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
 	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 
-	auto bindingDescription = Strand::getBindingDescription();
-	auto attributeDescriptions = Strand::getAttributeDescriptions();
-
-	vertexInputInfo.vertexBindingDescriptionCount = 1;
-	vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-	vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+	// No vertex buffers: one vertex per strand, the shaders fetch its curve points by gl_VertexIndex
+	vertexInputInfo.vertexBindingDescriptionCount = 0;
+	vertexInputInfo.pVertexBindingDescriptions = nullptr;
+	vertexInputInfo.vertexAttributeDescriptionCount = 0;
+	vertexInputInfo.pVertexAttributeDescriptions = nullptr;
 
 	// Input Assembly
 	VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
@@ -1565,6 +1920,7 @@ void Renderer::CreateHairPipeline() {
     vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
     vertShaderStageInfo.module = vertShaderModule;
     vertShaderStageInfo.pName = "main";
+    vertShaderStageInfo.pSpecializationInfo = &hairSpecializationInfo;
 
     VkPipelineShaderStageCreateInfo tescShaderStageInfo = {};
     tescShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -1577,6 +1933,7 @@ void Renderer::CreateHairPipeline() {
     teseShaderStageInfo.stage = VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
     teseShaderStageInfo.module = teseShaderModule;
     teseShaderStageInfo.pName = "main";
+    teseShaderStageInfo.pSpecializationInfo = &hairSpecializationInfo;
 
 	VkPipelineShaderStageCreateInfo geomShaderStageInfo = {};
 	geomShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -1598,13 +1955,11 @@ void Renderer::CreateHairPipeline() {
     VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 
-    auto bindingDescription = Strand::getBindingDescription();
-    auto attributeDescriptions = Strand::getAttributeDescriptions();
-
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-    vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+    // No vertex buffers: one vertex per strand, the shaders fetch its curve points by gl_VertexIndex
+    vertexInputInfo.vertexBindingDescriptionCount = 0;
+    vertexInputInfo.pVertexBindingDescriptions = nullptr;
+    vertexInputInfo.vertexAttributeDescriptionCount = 0;
+    vertexInputInfo.pVertexAttributeDescriptions = nullptr;
 
     // Input Assembly
     VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
@@ -1745,30 +2100,137 @@ void Renderer::CreateHairPipeline() {
 }
 
 
-void Renderer::CreateComputePipeline() {
-    // Set up programmable shaders
-    VkShaderModule computeShaderModule = ShaderModule::Create("shaders/compute.comp.spv", logicalDevice);
+void Renderer::CreateStrandCullPipeline() {
+    // The camera, the hair's set of the draw slot and the light camera, as in the hair passes
+    std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { cameraDescriptorSetLayout, hairDescriptorSetLayout, cameraDescriptorSetLayout };
+
+    // The hair's strand count
+    VkPushConstantRange numStrandsRange = {};
+    numStrandsRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    numStrandsRange.offset = 0;
+    numStrandsRange.size = sizeof(uint32_t);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
+    pipelineLayoutInfo.pSetLayouts = descriptorSetLayouts.data();
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &numStrandsRange;
+
+    if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &strandCullPipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create pipeline layout");
+    }
+
+    // Reads the strands through shaders/hairStrands.glsl, so it takes the hair passes' specialization
+    VkShaderModule computeShaderModule = ShaderModule::Create(STRAND_CULL_SHADER, logicalDevice);
 
     VkPipelineShaderStageCreateInfo computeShaderStageInfo = {};
     computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
     computeShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
     computeShaderStageInfo.module = computeShaderModule;
     computeShaderStageInfo.pName = "main";
+    computeShaderStageInfo.pSpecializationInfo = &hairSpecializationInfo;
+
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage = computeShaderStageInfo;
+    pipelineInfo.layout = strandCullPipelineLayout;
+    pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+    pipelineInfo.basePipelineIndex = -1;
+
+    if (vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &strandCullPipeline) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create compute pipeline");
+    }
+
+    vkDestroyShaderModule(logicalDevice, computeShaderModule, nullptr);
+}
 
+
+void Renderer::CreateComputePipeline() {
     std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { cameraDescriptorSetLayout, timeDescriptorSetLayout, collidersDescriptorSetLayout, gridDescriptorSetLayout, computeDescriptorSetLayout };
 
-    // Create pipeline layout
+    // The radix passes of the point sort take which pass they are as a push constant, the collision tests which
+    // part of the colliders' motion the substep covers
+    VkPushConstantRange pushConstantRange = {};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(SimulationPushConstants);
+
+    // Create pipeline layout, shared by every simulation stage
     VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
     pipelineLayoutInfo.pSetLayouts = descriptorSetLayouts.data();
-    pipelineLayoutInfo.pushConstantRangeCount = 0;
-    pipelineLayoutInfo.pPushConstantRanges = 0;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
     if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &computePipelineLayout) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create pipeline layout");
     }
 
+    CreateComputeStagePipelines();
+}
+
+
+void Renderer::CreateComputeStagePipelines() {
+    for (int stage = 0; stage < NUM_ACTIVE_COMPUTE_STAGES; ++stage) {
+        const char* shader = stage == PARTICLE_TO_GRID_STAGE && floatGridAtomics ? PARTICLE_TO_GRID_FLOAT_SHADER : COMPUTE_SHADERS[stage];
+        computePipelines[stage] = CreateComputeStagePipeline(shader, COMPUTE_WORKGROUP_SIZES[stage]);
+    }
+
+    strandGroupWorkgroupSize = std::max(STRAND_GROUP_WORKGROUP_SIZE / numCurvePoints, 1u) * numCurvePoints;
+    integrateStrandGroupPipeline = CreateComputeStagePipeline(INTEGRATE_STRAND_GROUP_SHADER, strandGroupWorkgroupSize);
+
+    if (sortGridPoints) {
+        sortHistogramPipeline = CreateComputeStagePipeline(SORT_HISTOGRAM_SHADER, POINT_SORT_TILE);
+        sortScanPipeline = CreateComputeStagePipeline(SORT_SCAN_SHADER, SORT_SCAN_WORKGROUP_SIZE);
+        sortScatterPipeline = CreateComputeStagePipeline(SORT_SCATTER_SHADER, POINT_SORT_TILE);
+    }
+}
+
+
+void Renderer::DestroyComputeStagePipelines() {
+    for (VkPipeline& pipeline : computePipelines) {
+        vkDestroyPipeline(logicalDevice, pipeline, nullptr);
+        pipeline = VK_NULL_HANDLE;
+    }
+    for (VkPipeline* pipeline : { &integrateStrandGroupPipeline, &sortHistogramPipeline, &sortScanPipeline, &sortScatterPipeline }) {
+        vkDestroyPipeline(logicalDevice, *pipeline, nullptr);
+        *pipeline = VK_NULL_HANDLE;
+    }
+}
+
+
+VkPipeline Renderer::CreateComputeStagePipeline(const std::string& shaderFilename, uint32_t workgroupSize) {
+    // Set up programmable shaders
+    VkShaderModule computeShaderModule = ShaderModule::Create(shaderFilename, logicalDevice);
+
+    // The shaders take their workgroup size from specialization constant 0 and the curve points per strand from 1.
+    // 2 is only read by integrateStrandGroup.comp, 3 says how the grid sums are stored and 4 whether the grid
+    // transfers go through the sorted points. 5 is the packed positions scale, shared with the hair passes
+    ComputeSpecialization specialization = { workgroupSize, numCurvePoints, STRAND_GROUP_FTL_PASSES, static_cast<VkBool32>(floatGridAtomics), static_cast<VkBool32>(sortGridPoints), PACKED_POSITION_SCALE };
+    std::array<VkSpecializationMapEntry, 6> specializationEntries = {{
+        { 0, offsetof(ComputeSpecialization, workgroupSize), sizeof(uint32_t) },
+        { 1, offsetof(ComputeSpecialization, numCurvePoints), sizeof(int32_t) },
+        { 2, offsetof(ComputeSpecialization, ftlPasses), sizeof(int32_t) },
+        { 3, offsetof(ComputeSpecialization, floatGridAtomics), sizeof(VkBool32) },
+        { 4, offsetof(ComputeSpecialization, sortGridPoints), sizeof(VkBool32) },
+        { 5, offsetof(ComputeSpecialization, packedPositionScale), sizeof(float) },
+    }};
+
+    VkSpecializationInfo specializationInfo = {};
+    specializationInfo.mapEntryCount = static_cast<uint32_t>(specializationEntries.size());
+    specializationInfo.pMapEntries = specializationEntries.data();
+    specializationInfo.dataSize = sizeof(ComputeSpecialization);
+    specializationInfo.pData = &specialization;
+
+    VkPipelineShaderStageCreateInfo computeShaderStageInfo = {};
+    computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    computeShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    computeShaderStageInfo.module = computeShaderModule;
+    computeShaderStageInfo.pName = "main";
+    computeShaderStageInfo.pSpecializationInfo = &specializationInfo;
+
     // Create compute pipeline
     VkComputePipelineCreateInfo pipelineInfo = {};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
@@ -1779,12 +2241,83 @@ void Renderer::CreateComputePipeline() {
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
     pipelineInfo.basePipelineIndex = -1;
 
-    if (vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &computePipeline) != VK_SUCCESS) {
+    VkPipeline pipeline;
+    if (vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create compute pipeline");
     }
 
     // No need for shader modules anymore
     vkDestroyShaderModule(logicalDevice, computeShaderModule, nullptr);
+
+    return pipeline;
+}
+
+
+void Renderer::CreateComputeQueryPool() {
+    VkPhysicalDevice physicalDevice = device->GetInstance()->GetPhysicalDevice();
+
+    // Not every queue family can write timestamps, profiling is simply off then
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+    if (queueFamilies[device->GetQueueIndex(QueueFlags::Compute)].timestampValidBits == 0) {
+        return;
+    }
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+    timestampPeriod = properties.limits.timestampPeriod;
+
+    // One timestamp before the first stage and one after each
+    VkQueryPoolCreateInfo queryPoolInfo = {};
+    queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolInfo.queryCount = NUM_ACTIVE_COMPUTE_STAGES + 1;
+
+    if (vkCreateQueryPool(logicalDevice, &queryPoolInfo, nullptr, &computeQueryPool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create query pool");
+    }
+}
+
+
+void Renderer::CreateSyncObjects() {
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    for (VkSemaphore& semaphore : simulationFinishedSemaphores) {
+        if (vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create semaphore");
+        }
+    }
+
+    // Signalled already, nothing has been submitted for the first frames to wait on
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+    for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        if (vkCreateFence(logicalDevice, &fenceInfo, nullptr, &renderFences[frame]) != VK_SUCCESS ||
+            vkCreateFence(logicalDevice, &fenceInfo, nullptr, &computeFences[frame]) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create fence");
+        }
+    }
+
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = MAX_FRAMES_IN_FLIGHT;
+
+    allocInfo.commandPool = graphicsCommandPool;
+    if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, graphicsUploadCommandBuffers.data()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate command buffers");
+    }
+
+    allocInfo.commandPool = computeCommandPool;
+    if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, computeUploadCommandBuffers.data()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate command buffers");
+    }
 }
 
 
@@ -2019,66 +2552,429 @@ void Renderer::RecreateFrameResources() {
 }
 
 
-void Renderer::RecordComputeCommandBuffer() {
-    // Specify the command pool and number of buffers to allocate
+namespace {
+    // Whole buffer barrier between two uses on the compute queue
+    VkBufferMemoryBarrier ComputeBufferBarrier(VkBuffer buffer, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask) {
+        VkBufferMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = srcAccessMask;
+        barrier.dstAccessMask = dstAccessMask;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = buffer;
+        barrier.offset = 0;
+        barrier.size = VK_WHOLE_SIZE;
+        return barrier;
+    }
+
+    // Release (on the srcQueueFamilyIndex queue) or acquire (on the dstQueueFamilyIndex one) of a whole buffer
+    VkBufferMemoryBarrier OwnershipBufferBarrier(VkBuffer buffer, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask, uint32_t srcQueueFamilyIndex, uint32_t dstQueueFamilyIndex) {
+        VkBufferMemoryBarrier barrier = ComputeBufferBarrier(buffer, srcAccessMask, dstAccessMask);
+        barrier.srcQueueFamilyIndex = srcQueueFamilyIndex;
+        barrier.dstQueueFamilyIndex = dstQueueFamilyIndex;
+        return barrier;
+    }
+
+    // Offset of one of the SimulationLod::dispatches in the pool's lod buffer, and of AwakeStrands::dispatches in
+    // its awake strands
+    VkDeviceSize LodDispatchOffset(SimulationLodDispatch dispatch) {
+        return offsetof(SimulationLod, dispatches) + dispatch * sizeof(glm::uvec4);
+    }
+
+    VkDeviceSize AwakeDispatchOffset(AwakeDispatch dispatch) {
+        return offsetof(AwakeStrands, dispatches) + dispatch * sizeof(glm::uvec4);
+    }
+
+    // Offset of a view's draw in the pool's culled strands
+    VkDeviceSize CullDrawOffset(CullView view) {
+        return offsetof(CulledStrands, draws) + view * sizeof(StrandDrawIndirect);
+    }
+
+    // Same for a color image that stays in VK_IMAGE_LAYOUT_GENERAL
+    VkImageMemoryBarrier ComputeImageBarrier(VkImage image, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask) {
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = srcAccessMask;
+        barrier.dstAccessMask = dstAccessMask;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image;
+        barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        return barrier;
+    }
+}
+
+
+void Renderer::TransferSimulationResources() {
+    if (!separateComputeFamily) {
+        return;
+    }
+
+    // Everything the simulation reads was uploaded on the graphics queue, hand it to the compute family once
+    const uint32_t graphicsFamily = device->GetQueueIndex(QueueFlags::Graphics);
+    const uint32_t computeFamily = device->GetQueueIndex(QueueFlags::Compute);
+
+    std::vector<VkBuffer> buffers = { scene->GetTimeBuffer(), scene->GetCollidersBuffer(), scene->GetGridBuffer(), scene->GetGridBoundsBuffer(), scene->GetGridBricksBuffer() };
+    buffers.insert(buffers.end(), { simulationPositionsBuffer, simulationVelocitiesBuffer, lodStrandsBuffer, lodNeighborsBuffer, restingStepsBuffer });
+
+    std::vector<VkImageMemoryBarrier> imageBarriers = {
+        ComputeImageBarrier(scene->GetGridVelocityImage(), 0, 0),
+        ComputeImageBarrier(scene->GetSdfImage(), 0, 0),
+    };
+    imageBarriers[1].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    imageBarriers[1].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    for (bool release : { true, false }) {
+        VkCommandPool commandPool = release ? graphicsCommandPool : computeCommandPool;
+        VkQueue queue = device->GetQueue(release ? QueueFlags::Graphics : QueueFlags::Compute);
+
+        std::vector<VkBufferMemoryBarrier> bufferBarriers;
+        for (VkBuffer buffer : buffers) {
+            bufferBarriers.push_back(OwnershipBufferBarrier(buffer, release ? VK_ACCESS_TRANSFER_WRITE_BIT : 0, release ? 0 : VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, graphicsFamily, computeFamily));
+        }
+        for (VkImageMemoryBarrier& barrier : imageBarriers) {
+            barrier.srcAccessMask = release ? VK_ACCESS_TRANSFER_WRITE_BIT : 0;
+            barrier.dstAccessMask = release ? 0 : VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+            barrier.srcQueueFamilyIndex = graphicsFamily;
+            barrier.dstQueueFamilyIndex = computeFamily;
+        }
+
+        VkCommandBufferAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandPool = commandPool;
+        allocInfo.commandBufferCount = 1;
+
+        VkCommandBuffer commandBuffer;
+        if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate command buffers");
+        }
+
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        vkBeginCommandBuffer(commandBuffer, &beginInfo);
+        vkCmdPipelineBarrier(commandBuffer,
+            release ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+            release ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+            0, 0, nullptr, static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(), static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+        vkEndCommandBuffer(commandBuffer);
+
+        // The release has to be done before the acquire runs, waiting on the queue in between takes care of that
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
+
+        if (vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to submit ownership transfer");
+        }
+        vkQueueWaitIdle(queue);
+        vkFreeCommandBuffers(logicalDevice, commandPool, 1, &commandBuffer);
+    }
+}
+
+
+void Renderer::RecordDrawSlotAcquires() {
+    if (!separateComputeFamily) {
+        return;
+    }
+
     VkCommandBufferAllocateInfo allocInfo = {};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.commandPool = computeCommandPool;
+    allocInfo.commandPool = graphicsCommandPool;
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandBufferCount = 1;
+    allocInfo.commandBufferCount = NUM_DRAW_SLOTS;
 
-    if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, &computeCommandBuffer) != VK_SUCCESS) {
+    if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, drawSlotAcquireCommandBuffers.data()) != VK_SUCCESS) {
         throw std::runtime_error("Failed to allocate command buffers");
     }
 
-    VkCommandBufferBeginInfo beginInfo = {};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-    beginInfo.pInheritanceInfo = nullptr;
+    for (int slot = 0; slot < NUM_DRAW_SLOTS; ++slot) {
+        VkCommandBuffer commandBuffer = drawSlotAcquireCommandBuffers[slot];
 
-    // ~ Start recording ~
-    if (vkBeginCommandBuffer(computeCommandBuffer, &beginInfo) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to begin recording compute command buffer");
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+
+        if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to begin recording command buffer");
+        }
+
+        // Matches the release at the end of the compute command buffers writing this slot
+        std::vector<VkBufferMemoryBarrier> barriers;
+        for (VkBuffer buffer : { poolPositionsBuffers[slot], poolPrevPositionsBuffers[slot] }) {
+            barriers.push_back(OwnershipBufferBarrier(buffer, 0, VK_ACCESS_SHADER_READ_BIT, device->GetQueueIndex(QueueFlags::Compute), device->GetQueueIndex(QueueFlags::Graphics)));
+        }
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+
+        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to record command buffer");
+        }
     }
+}
+
+
+void Renderer::RecordComputeCommandBuffer() {
+    // One command buffer per draw slot and substep count, computeCommandBuffers[slot * max substeps + n - 1] runs
+    // n substeps and copies the result into the slot
+    const uint32_t maxSubsteps = static_cast<uint32_t>(scene->GetMaxSubsteps());
+    computeCommandBuffers.resize(NUM_DRAW_SLOTS * maxSubsteps);
 
-	/*std::vector<uint32_t> data = std::vector<uint32_t>();
-	data.resize(scene->GetGrid().size() * 4, uint32_t(0));*/
+    // Specify the command pool and number of buffers to allocate
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = computeCommandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = static_cast<uint32_t>(computeCommandBuffers.size());
 
+    if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, computeCommandBuffers.data()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate command buffers");
+    }
 
+    // Integrate records a dispatch for each solver some hair group uses, each skipping the other solver's guides
+    bool threadPerStrand = false;
+    bool strandGroups = false;
+    for (const Hair* hair : scene->GetHair()) {
+        threadPerStrand |= hair->GetSolver() == StrandSolver::ThreadPerStrand;
+        strandGroups |= hair->GetSolver() == StrandSolver::WorkgroupPerStrand;
+    }
 
-    // Bind to the compute pipeline
-    vkCmdBindPipeline(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
+    for (uint32_t k = 0; k < computeCommandBuffers.size(); ++k) {
+        VkCommandBuffer commandBuffer = computeCommandBuffers[k];
+        const int slot = k / maxSubsteps;
+        const uint32_t n = k % maxSubsteps;
 
-    // Bind camera descriptor set
-    vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 0, 1, &cameraDescriptorSet, 0, nullptr);
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+        beginInfo.pInheritanceInfo = nullptr;
 
-    // Bind descriptor set for time uniforms
-    vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 1, 1, &timeDescriptorSet, 0, nullptr);
+        // ~ Start recording ~
+        if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to begin recording compute command buffer");
+        }
 
-	// Bind descriptor set for collider uniforms
-    vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 2, 1, &collidersDescriptorSets, 0, nullptr);
+        if (computeQueryPool != VK_NULL_HANDLE) {
+            vkCmdResetQueryPool(commandBuffer, computeQueryPool, 0, NUM_ACTIVE_COMPUTE_STAGES + 1);
+        }
 
-	// Bind descriptor set for grid uniforms
-	vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 3, 1, &gridDescriptorSets, 0, nullptr);
-	vkCmdFillBuffer(computeCommandBuffer, scene->GetGridBuffer(), 0, scene->GetGrid().size() * sizeof(GridCell), 0);
+        // Bind camera descriptor set
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 0, 1, &cameraDescriptorSet, 0, nullptr);
+
+        // Bind descriptor set for time uniforms
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 1, 1, &timeDescriptorSet, 0, nullptr);
+
+        // Bind descriptor set for colliders
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 2, 1, &collidersDescriptorSets, 0, nullptr);
+
+        // Bind descriptor set for grid uniforms
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 3, 1, &gridDescriptorSets, 0, nullptr);
+
+        // Bind the strand pool, every stage covers all the hair groups with one dispatch. packPositions writes the
+        // draw slot's render positions
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 4, 1, &computeDescriptorSets[slot], 0, nullptr);
+
+        for (uint32_t substep = 0; substep <= n; ++substep) {
+            // Only the last substep is timed, the query pool holds one set of timestamps
+            const bool timed = computeQueryPool != VK_NULL_HANDLE && substep == n;
+
+            // The previous substep, or the previous submission, has to be done with the strands and grid before they are touched again
+            VkMemoryBarrier barrier = {};
+            barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+            if (substep == n) {
+                // Keep the state before the last substep so rendering can interpolate towards the newest one, packed
+                // straight into the slot's previous render positions. Unpacked they are the simulation's own
+                if (PACK_STRAND_POSITIONS) {
+                    const uint32_t workgroupSize = COMPUTE_WORKGROUP_SIZES[PACK_POSITIONS_STAGE];
+                    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 4, 1, &prevComputeDescriptorSets[slot], 0, nullptr);
+                    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelines[PACK_POSITIONS_STAGE]);
+                    vkCmdDispatch(commandBuffer, (numPoolStrands * numCurvePoints + workgroupSize - 1) / workgroupSize, 1, 1);
+                    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 4, 1, &computeDescriptorSets[slot], 0, nullptr);
+                }
+                else {
+                    VkBufferCopy copyRegion = {};
+                    copyRegion.size = poolPositionsSize;
+                    vkCmdCopyBuffer(commandBuffer, simulationPositionsBuffer, poolPrevPositionsBuffers[slot], 1, &copyRegion);
+                }
+            }
+
+            // Empty the grid bounds, reset the grid brick counters and clear the awake strands with their dispatches.
+            // The grid sums were zeroed by the last gridNormalize, the brick table and grid velocities by the last
+            // gridRelease, so nothing here grows with the grid
+            std::vector<VkBufferMemoryBarrier> clearBarriers;
+            vkCmdFillBuffer(commandBuffer, scene->GetGridBoundsBuffer(), offsetof(GridBounds, lo), sizeof(GridBounds::lo), 0xFFFFFFFF);
+            vkCmdFillBuffer(commandBuffer, scene->GetGridBoundsBuffer(), offsetof(GridBounds, hi), sizeof(GridBounds::hi), 0);
+            clearBarriers.push_back(ComputeBufferBarrier(scene->GetGridBoundsBuffer(), VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT));
+            vkCmdFillBuffer(commandBuffer, scene->GetGridBricksBuffer(), offsetof(GridBricks, numBricks), sizeof(uint32_t), 0);
+            vkCmdFillBuffer(commandBuffer, scene->GetGridBricksBuffer(), offsetof(GridBricks, maxBrickPoints), sizeof(uint32_t), 0);
+            clearBarriers.push_back(ComputeBufferBarrier(scene->GetGridBricksBuffer(), VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT));
+            vkCmdFillBuffer(commandBuffer, awakeStrandsBuffer, 0, sizeof(AwakeStrands), 0);
+            clearBarriers.push_back(ComputeBufferBarrier(awakeStrandsBuffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT));
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, static_cast<uint32_t>(clearBarriers.size()), clearBarriers.data(), 0, nullptr);
+
+            if (timed) {
+                vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, computeQueryPool, 0);
+            }
+
+            // The colliders moved once this frame, each of the n + 1 substeps sweeps its share of the motion
+            const float sweep[] = { static_cast<float>(substep) / (n + 1), static_cast<float>(substep + 1) / (n + 1) };
+            vkCmdPushConstants(commandBuffer, computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, offsetof(SimulationPushConstants, sweepBegin), sizeof(sweep), sweep);
+
+            for (int stage = 0; stage < NUM_ACTIVE_COMPUTE_STAGES; ++stage) {
+                if (stage > GRID_BOUNDS_STAGE && stage != SORT_POINTS_STAGE) {
+                    // Each stage reads what the ones before it wrote: integrate -> positions and velocities,
+                    // gridBounds -> bounds, gridAllocate -> bricks (also read as gridNormalize's dispatch),
+                    // sortPoints -> sorted points, particleToGrid -> grid sums, gridNormalize -> grid velocities,
+                    // gridToParticle -> the guides' velocities interpolate follows, interpolate -> the positions
+                    // packPositions reads, and gridRelease waits for gridToParticle to be done with the velocities
+                    // it zeroes. gridBounds and sortPoints only read positions, which were made visible before
+                    // gridBounds, and sortPoints reads the bounds after gridAllocate's barrier
+                    VkPipelineStageFlags dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+                    std::vector<VkBufferMemoryBarrier> stageBarriers;
+                    std::vector<VkImageMemoryBarrier> imageBarriers;
+                    if (stage == GRID_ALLOCATE_STAGE) {
+                        stageBarriers.push_back(ComputeBufferBarrier(scene->GetGridBoundsBuffer(), VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT));
+                    }
+                    else if (stage == PARTICLE_TO_GRID_STAGE) {
+                        stageBarriers.push_back(ComputeBufferBarrier(simulationVelocitiesBuffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT));
+                        if (sortGridPoints) {
+                            stageBarriers.push_back(ComputeBufferBarrier(sortedPointsBuffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT));
+                        }
+                        stageBarriers.push_back(ComputeBufferBarrier(scene->GetGridBricksBuffer(), VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT));
+                        dstStageMask |= VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+                    }
+                    else if (stage == GRID_NORMALIZE_STAGE) {
+                        stageBarriers.push_back(ComputeBufferBarrier(scene->GetGridBuffer(), VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT));
+                    }
+                    else if (stage == GRID_TO_PARTICLE_STAGE) {
+                        imageBarriers.push_back(ComputeImageBarrier(scene->GetGridVelocityImage(), VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT));
+                    }
+                    else if (stage == GRID_RELEASE_STAGE) {
+                        imageBarriers.push_back(ComputeImageBarrier(scene->GetGridVelocityImage(), VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_SHADER_WRITE_BIT));
+                    }
+                    else {
+                        VkBuffer buffer = stage == INTERPOLATE_STAGE ? simulationVelocitiesBuffer : simulationPositionsBuffer;
+                        stageBarriers.push_back(ComputeBufferBarrier(buffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT));
+                    }
+                    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, dstStageMask, 0, 0, nullptr, static_cast<uint32_t>(stageBarriers.size()), stageBarriers.data(), static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+                }
+                else if (stage == INTEGRATE_STAGE) {
+                    // The awake guides and their dispatches, and the velocities of the guides that just came to rest
+                    std::vector<VkBufferMemoryBarrier> stageBarriers = {
+                        ComputeBufferBarrier(awakeStrandsBuffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT),
+                        ComputeBufferBarrier(simulationVelocitiesBuffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT),
+                    };
+                    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 0, nullptr, static_cast<uint32_t>(stageBarriers.size()), stageBarriers.data(), 0, nullptr);
+                }
+                else if (stage == GRID_BOUNDS_STAGE) {
+                    VkBufferMemoryBarrier positionsBarrier = ComputeBufferBarrier(simulationPositionsBuffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+                    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 1, &positionsBarrier, 0, nullptr);
+                }
+
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelines[stage]);
+                const uint32_t workgroupSize = COMPUTE_WORKGROUP_SIZES[stage];
+
+                if (stage == INTEGRATE_STAGE) {
+                    // Each group integrates the awake guides of its simulation LOD with the solver it asked for, one
+                    // invocation per strand or a group of invocations per strand with one per curve point. Both
+                    // dispatches run over every awake guide and leave the other solver's alone
+                    if (threadPerStrand) {
+                        vkCmdDispatchIndirect(commandBuffer, awakeStrandsBuffer, AwakeDispatchOffset(AWAKE_DISPATCH_INTEGRATE));
+                    }
+                    if (strandGroups) {
+                        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, integrateStrandGroupPipeline);
+                        vkCmdDispatchIndirect(commandBuffer, awakeStrandsBuffer, AwakeDispatchOffset(AWAKE_DISPATCH_INTEGRATE_STRAND_GROUP));
+                    }
+                }
+                else if (stage == SORT_POINTS_STAGE) {
+                    if (sortGridPoints) {
+                        RecordPointSort(commandBuffer);
+                    }
+                }
+                else if (stage == GRID_NORMALIZE_STAGE || stage == GRID_RELEASE_STAGE) {
+                    // One workgroup per brick gridAllocate claimed
+                    vkCmdDispatchIndirect(commandBuffer, scene->GetGridBricksBuffer(), offsetof(GridBricks, numBricks));
+                }
+                else if (stage == PACK_POSITIONS_STAGE) {
+                    // Only the last substep is drawn, packed straight into the draw slot's render positions
+                    if (substep == n) {
+                        uint32_t numInvocations = numPoolStrands * numCurvePoints;
+                        vkCmdDispatch(commandBuffer, (numInvocations + workgroupSize - 1) / workgroupSize, 1, 1);
+                    }
+                }
+                else {
+                    // One invocation per curve point of the pool (gridBounds), or as many as the simulation LODs of
+                    // the groups ask for: per guide (compactAwake), per simulated curve point of the awake guides
+                    // (grid transfers) or per curve point of the interpolated strands (interpolate)
+                    if (stage == GRID_BOUNDS_STAGE) {
+                        uint32_t numInvocations = numPoolStrands * numCurvePoints;
+                        vkCmdDispatch(commandBuffer, (numInvocations + workgroupSize - 1) / workgroupSize, 1, 1);
+                    }
+                    else if (stage == COMPACT_AWAKE_STAGE || stage == INTERPOLATE_STAGE) {
+                        SimulationLodDispatch dispatch = stage == COMPACT_AWAKE_STAGE ? LOD_DISPATCH_COMPACT_AWAKE : LOD_DISPATCH_INTERPOLATE;
+                        vkCmdDispatchIndirect(commandBuffer, lodBuffer, LodDispatchOffset(dispatch));
+                    }
+                    else {
+                        AwakeDispatch dispatch = stage == GRID_ALLOCATE_STAGE ? AWAKE_DISPATCH_GRID_ALLOCATE :
+                            stage == PARTICLE_TO_GRID_STAGE ? AWAKE_DISPATCH_PARTICLE_TO_GRID : AWAKE_DISPATCH_GRID_TO_PARTICLE;
+                        vkCmdDispatchIndirect(commandBuffer, awakeStrandsBuffer, AwakeDispatchOffset(dispatch));
+                    }
+                }
+
+                if (timed) {
+                    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, computeQueryPool, stage + 1);
+                }
+            }
+        }
 
+        // Without packing the newest render positions are the simulation's own, copied into the draw slot's pool.
+        // The frame drawing from it waits on the semaphore this submission signals
+        if (!PACK_STRAND_POSITIONS) {
+            VkMemoryBarrier copyBarrier = {};
+            copyBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            copyBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            copyBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &copyBarrier, 0, nullptr, 0, nullptr);
+
+            VkBufferCopy copyRegion = {};
+            copyRegion.size = poolPositionsSize;
+            vkCmdCopyBuffer(commandBuffer, simulationPositionsBuffer, poolPositionsBuffers[slot], 1, &copyRegion);
+        }
 
-	// TODO: for each group of strands, bind its descriptor set and dispatch
-	// Check these function inputs.  Uncomment dispatch when ready to run compute shader.
-	for (int i = 0; i < scene->GetHair().size(); ++i) {
-		vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 4 + i, 1, &computeDescriptorSets[i], 0, nullptr);
-		vkCmdDispatch(computeCommandBuffer, (int)ceil((scene->GetHair()[i]->GetNumStrands() + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE), 1, 1);
-	}
+        // The graphics family takes the slot over with the barriers in drawSlotAcquireCommandBuffers[slot]. The way
+        // back needs no transfer, the simulation overwrites all of it
+        const VkAccessFlags slotWriteAccess = PACK_STRAND_POSITIONS ? VK_ACCESS_SHADER_WRITE_BIT : VK_ACCESS_TRANSFER_WRITE_BIT;
+        const VkPipelineStageFlags slotWriteStages = PACK_STRAND_POSITIONS ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT : VK_PIPELINE_STAGE_TRANSFER_BIT;
+        std::vector<VkBufferMemoryBarrier> releaseBarriers;
+        if (separateComputeFamily) {
+            for (VkBuffer buffer : { poolPositionsBuffers[slot], poolPrevPositionsBuffers[slot] }) {
+                releaseBarriers.push_back(OwnershipBufferBarrier(buffer, slotWriteAccess, 0, device->GetQueueIndex(QueueFlags::Compute), device->GetQueueIndex(QueueFlags::Graphics)));
+            }
+        }
+        if (!releaseBarriers.empty()) {
+            vkCmdPipelineBarrier(commandBuffer, slotWriteStages, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, static_cast<uint32_t>(releaseBarriers.size()), releaseBarriers.data(), 0, nullptr);
+        }
 
-    // ~ End recording ~
-    if (vkEndCommandBuffer(computeCommandBuffer) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to record compute command buffer");
+        // ~ End recording ~
+        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to record compute command buffer");
+        }
     }
 }
 
 
 void Renderer::RecordCommandBuffers() {
-    commandBuffers.resize(swapChain->GetCount());
+    // One command buffer per draw slot and swap chain image
+    const uint32_t numImages = swapChain->GetCount();
+    commandBuffers.resize(NUM_DRAW_SLOTS * numImages);
 
     // Specify the command pool and number of buffers to allocate
     VkCommandBufferAllocateInfo allocInfo = {};
@@ -2092,17 +2988,21 @@ void Renderer::RecordCommandBuffers() {
     }
 
     // Start command buffer recording
-    for (size_t i = 0; i < commandBuffers.size(); i++) {
+    for (size_t k = 0; k < commandBuffers.size(); k++) {
+        const size_t i = k % numImages;
+        const int slot = static_cast<int>(k / numImages);
         VkCommandBufferBeginInfo beginInfo = {};
         beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
         beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
         beginInfo.pInheritanceInfo = nullptr;
 
         // ~ Start recording ~
-        if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) != VK_SUCCESS) {
+        if (vkBeginCommandBuffer(commandBuffers[k], &beginInfo) != VK_SUCCESS) {
             throw std::runtime_error("Failed to begin recording command buffer");
         }
 
+        RecordStrandCull(commandBuffers[k], slot);
+
 		// First pass: generate shadow map by rendering the hair from the light's POV -----------------------
 		VkClearValue shadowMapClearValues[1];
 		shadowMapClearValues[0].depthStencil.depth = 1.0f;
@@ -2120,7 +3020,7 @@ void Renderer::RecordCommandBuffers() {
 		shadowMapRenderPassBeginInfo.clearValueCount = 1;
 		shadowMapRenderPassBeginInfo.pClearValues = shadowMapClearValues;
 
-		vkCmdBeginRenderPass(commandBuffers[i], &shadowMapRenderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+		vkCmdBeginRenderPass(commandBuffers[k], &shadowMapRenderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
 		VkViewport opacityMapViewport;
 		opacityMapViewport.height = SHADOWMAP_HEIGHT;
@@ -2130,7 +3030,7 @@ void Renderer::RecordCommandBuffers() {
 		opacityMapViewport.x = 0;
 		opacityMapViewport.y = 0;
 
-		vkCmdSetViewport(commandBuffers[i], 0, 1, &opacityMapViewport);
+		vkCmdSetViewport(commandBuffers[k], 0, 1, &opacityMapViewport);
 
 		VkRect2D opacityMapScissor;
 		opacityMapScissor.extent.width = SHADOWMAP_WIDTH;
@@ -2138,30 +3038,25 @@ void Renderer::RecordCommandBuffers() {
 		opacityMapScissor.offset.x = 0;
 		opacityMapScissor.offset.y = 0;
 
-		vkCmdSetScissor(commandBuffers[i], 0, 1, &opacityMapScissor);
+		vkCmdSetScissor(commandBuffers[k], 0, 1, &opacityMapScissor);
 
 		const float depthBiasConstant = 1.25f;
 		const float depthBiasSlope = 1.75f;
 
 		// Set depth bias, required to avoid shadow mapping artifacts
-		vkCmdSetDepthBias(commandBuffers[i], depthBiasConstant, 0.0f, depthBiasSlope);
+		vkCmdSetDepthBias(commandBuffers[k], depthBiasConstant, 0.0f, depthBiasSlope);
 
-		vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, shadowMapPipelineLayout, 0, 1, &shadowCameraDescriptorSet, 0, nullptr);
+		vkCmdBindDescriptorSets(commandBuffers[k], VK_PIPELINE_BIND_POINT_GRAPHICS, shadowMapPipelineLayout, 0, 1, &shadowCameraDescriptorSet, 0, nullptr);
 
-		vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, shadowMapPipeline);
+		vkCmdBindPipeline(commandBuffers[k], VK_PIPELINE_BIND_POINT_GRAPHICS, shadowMapPipeline);
 
-		for (uint32_t j = 0; j < scene->GetHair().size(); ++j) {
-			VkBuffer vertexBuffers[] = { scene->GetHair()[j]->GetStrandsBuffer() };
-			VkDeviceSize offsets[] = { 0 };
-			vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
+		// Every hair group in one draw of the strands the light sees
+		vkCmdBindDescriptorSets(commandBuffers[k], VK_PIPELINE_BIND_POINT_GRAPHICS, shadowMapPipelineLayout, 1, 1, &hairDescriptorSets[slot], 0, nullptr);
+		vkCmdBindDescriptorSets(commandBuffers[k], VK_PIPELINE_BIND_POINT_GRAPHICS, shadowMapPipelineLayout, 2, 1, &shadowCameraDescriptorSet, 0, nullptr);
 
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, shadowMapPipelineLayout, 1, 1, &opacityMapHairDescriptorSets[j], 0, nullptr);
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, shadowMapPipelineLayout, 2, 1, &shadowCameraDescriptorSet, 0, nullptr);
+		vkCmdDrawIndirect(commandBuffers[k], culledStrandsBuffer, CullDrawOffset(CULL_VIEW_LIGHT), 1, sizeof(StrandDrawIndirect));
 
-			vkCmdDrawIndirect(commandBuffers[i], scene->GetHair()[j]->GetNumStrandsBuffer(), 1, 1, sizeof(StrandDrawIndirect));
-		}
-
-		vkCmdEndRenderPass(commandBuffers[i]);
+		vkCmdEndRenderPass(commandBuffers[k]);
 
 		// apparently don't need any synchronization between render passes, done implicity via subpass dependencies
 
@@ -2182,7 +3077,7 @@ void Renderer::RecordCommandBuffers() {
 		opacityMapRenderPassBeginInfo.clearValueCount = 1;
 		opacityMapRenderPassBeginInfo.pClearValues = opacityMapClearValues;
 
-		vkCmdBeginRenderPass(commandBuffers[i], &opacityMapRenderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
+		vkCmdBeginRenderPass(commandBuffers[k], &opacityMapRenderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
 
 		VkViewport shadowMapViewport;
 		shadowMapViewport.height = SHADOWMAP_HEIGHT;
@@ -2192,7 +3087,7 @@ void Renderer::RecordCommandBuffers() {
 		shadowMapViewport.x = 0;
 		shadowMapViewport.y = 0;
 
-		vkCmdSetViewport(commandBuffers[i], 0, 1, &shadowMapViewport);
+		vkCmdSetViewport(commandBuffers[k], 0, 1, &shadowMapViewport);
 
 		VkRect2D shadowMapScissor;
 		shadowMapScissor.extent.width = SHADOWMAP_WIDTH;
@@ -2200,27 +3095,22 @@ void Renderer::RecordCommandBuffers() {
 		shadowMapScissor.offset.x = 0;
 		shadowMapScissor.offset.y = 0;
 
-		vkCmdSetScissor(commandBuffers[i], 0, 1, &shadowMapScissor);
+		vkCmdSetScissor(commandBuffers[k], 0, 1, &shadowMapScissor);
 
 		// Set depth bias, required to avoid shadow mapping artifacts
-		vkCmdSetDepthBias(commandBuffers[i], depthBiasConstant, 0.0f, depthBiasSlope);
-
-		vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, opacityMapPipelineLayout, 0, 1, &shadowCameraDescriptorSet, 0, nullptr);
+		vkCmdSetDepthBias(commandBuffers[k], depthBiasConstant, 0.0f, depthBiasSlope);
 
-		vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, opacityMapPipeline);
+		vkCmdBindDescriptorSets(commandBuffers[k], VK_PIPELINE_BIND_POINT_GRAPHICS, opacityMapPipelineLayout, 0, 1, &shadowCameraDescriptorSet, 0, nullptr);
 
-		for (uint32_t j = 0; j < scene->GetHair().size(); ++j) {
-			VkBuffer vertexBuffers[] = { scene->GetHair()[j]->GetStrandsBuffer() };
-			VkDeviceSize offsets[] = { 0 };
-			vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
+		vkCmdBindPipeline(commandBuffers[k], VK_PIPELINE_BIND_POINT_GRAPHICS, opacityMapPipeline);
 
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, shadowMapPipelineLayout, 1, 1, &opacityMapHairDescriptorSets[j], 0, nullptr);
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, shadowMapPipelineLayout, 2, 1, &shadowCameraDescriptorSet, 0, nullptr);
+		// Every hair group in one draw of the strands the light sees
+		vkCmdBindDescriptorSets(commandBuffers[k], VK_PIPELINE_BIND_POINT_GRAPHICS, shadowMapPipelineLayout, 1, 1, &hairDescriptorSets[slot], 0, nullptr);
+		vkCmdBindDescriptorSets(commandBuffers[k], VK_PIPELINE_BIND_POINT_GRAPHICS, shadowMapPipelineLayout, 2, 1, &shadowCameraDescriptorSet, 0, nullptr);
 
-			vkCmdDrawIndirect(commandBuffers[i], scene->GetHair()[j]->GetNumStrandsBuffer(), 1, 1, sizeof(StrandDrawIndirect));
-		}
+		vkCmdDrawIndirect(commandBuffers[k], culledStrandsBuffer, CullDrawOffset(CULL_VIEW_LIGHT), 1, sizeof(StrandDrawIndirect));
 
-		vkCmdEndRenderPass(commandBuffers[i]);
+		vkCmdEndRenderPass(commandBuffers[k]);
 
 
         // third pass: normal graphics and hair ----------------------------------------
@@ -2237,135 +3127,469 @@ void Renderer::RecordCommandBuffers() {
         renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
         renderPassInfo.pClearValues = clearValues.data();
 
-		std::vector<VkBufferMemoryBarrier> barriers(scene->GetHair().size());
-        for (uint32_t j = 0; j < barriers.size(); ++j) {
-            barriers[j].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-            barriers[j].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-            barriers[j].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
-            barriers[j].srcQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Compute);
-            barriers[j].dstQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Graphics);
-            barriers[j].buffer = scene->GetHair()[j]->GetNumStrandsBuffer();
-            barriers[j].offset = 0;
-            barriers[j].size = sizeof(StrandDrawIndirect);
-        } 
-
-
-		// TODO: move barrier before first graphics pass?
-		vkCmdPipelineBarrier(commandBuffers[i], VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 0, nullptr, barriers.size(), barriers.data(), 0, nullptr);
-
         // Bind the camera descriptor set. This is set 0 in all pipelines so it will be inherited
-        vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 0, 1, &cameraDescriptorSet, 0, nullptr);
+        vkCmdBindDescriptorSets(commandBuffers[k], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 0, 1, &cameraDescriptorSet, 0, nullptr);
 
-        vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        vkCmdBeginRenderPass(commandBuffers[k], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
         // Bind the graphics pipeline
-        vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+        vkCmdBindPipeline(commandBuffers[k], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
 
         for (uint32_t j = 0; j < scene->GetModels().size(); ++j) {
             // Bind the vertex and index buffers
             VkBuffer vertexBuffers[] = { scene->GetModels()[j]->getVertexBuffer() };
             VkDeviceSize offsets[] = { 0 };
-            vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
+            vkCmdBindVertexBuffers(commandBuffers[k], 0, 1, vertexBuffers, offsets);
 
-            vkCmdBindIndexBuffer(commandBuffers[i], scene->GetModels()[j]->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
+            vkCmdBindIndexBuffer(commandBuffers[k], scene->GetModels()[j]->getIndexBuffer(), 0, VK_INDEX_TYPE_UINT32);
 
 			// Bind the descriptor set for each model
-            vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 1, 1, &textureDescriptorSets[j], 0, nullptr);
+            vkCmdBindDescriptorSets(commandBuffers[k], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 1, 1, &textureDescriptorSets[j], 0, nullptr);
 
 			uint32_t dynamicOffset = j * this->scene->dynamicAlignment;
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 2, 1, &modelDescriptorSet, 1, &dynamicOffset);
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 3, 1, &shadowCameraDescriptorSet, 0, nullptr);
+			vkCmdBindDescriptorSets(commandBuffers[k], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 2, 1, &modelDescriptorSet, 1, &dynamicOffset);
+			vkCmdBindDescriptorSets(commandBuffers[k], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 3, 1, &shadowCameraDescriptorSet, 0, nullptr);
 
             std::vector<uint32_t> indices = scene->GetModels()[j]->getIndices();
-            vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+            vkCmdDrawIndexed(commandBuffers[k], static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
         }
 
         // Bind the hair pipeline
-        vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, hairPipeline);
+        vkCmdBindPipeline(commandBuffers[k], VK_PIPELINE_BIND_POINT_GRAPHICS, hairPipeline);
 
-        for (uint32_t j = 0; j < scene->GetHair().size(); ++j) {
-            VkBuffer vertexBuffers[] = { scene->GetHair()[j]->GetStrandsBuffer() }; 
-            VkDeviceSize offsets[] = { 0 };
-			vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
+        // Every hair group in one draw of the strands the camera sees
+        vkCmdBindDescriptorSets(commandBuffers[k], VK_PIPELINE_BIND_POINT_GRAPHICS, hairPipelineLayout, 1, 1, &hairDescriptorSets[slot], 0, nullptr);
+        vkCmdBindDescriptorSets(commandBuffers[k], VK_PIPELINE_BIND_POINT_GRAPHICS, hairPipelineLayout, 2, 1, &shadowCameraDescriptorSet, 0, nullptr);
+        vkCmdBindDescriptorSets(commandBuffers[k], VK_PIPELINE_BIND_POINT_GRAPHICS, hairPipelineLayout, 3, 1, &opacityMapDescriptorSet, 0, nullptr);
 
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, hairPipelineLayout, 1, 1, &hairDescriptorSets[j], 0, nullptr);
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, hairPipelineLayout, 2, 1, &shadowCameraDescriptorSet, 0, nullptr);
-			vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, hairPipelineLayout, 3, 1, &opacityMapDescriptorSets[j], 0, nullptr);
-
-			vkCmdDrawIndirect(commandBuffers[i], scene->GetHair()[j]->GetNumStrandsBuffer(), 0, 1, sizeof(StrandDrawIndirect));
-        }
+        vkCmdDrawIndirect(commandBuffers[k], culledStrandsBuffer, CullDrawOffset(CULL_VIEW_CAMERA), 1, sizeof(StrandDrawIndirect));
 
         // End render pass
-        vkCmdEndRenderPass(commandBuffers[i]);
+        vkCmdEndRenderPass(commandBuffers[k]);
 
         // ~ End recording ~
-        if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
+        if (vkEndCommandBuffer(commandBuffers[k]) != VK_SUCCESS) {
             throw std::runtime_error("Failed to record command buffer");
         }
     }
 }
 
 
-void Renderer::Frame() {
+void Renderer::RecordStrandCull(VkCommandBuffer commandBuffer, int slot) {
+    // The cull pass and hair passes of the frame before are the only other users of the culled strands, start
+    // the lists over once they're done
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    // Each view's list starts right after the one before
+    CulledStrands culledStrands = {};
+    for (int view = 0; view < NUM_CULL_VIEWS; ++view) {
+        culledStrands.draws[view].instanceCount = 1;
+        culledStrands.draws[view].firstVertex = view * numPoolStrands;
+    }
+    vkCmdUpdateBuffer(commandBuffer, culledStrandsBuffer, 0, sizeof(CulledStrands), &culledStrands);
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    // One invocation per pool strand, reading the slot's positions the way the hair passes will
+    const uint32_t numStrands = static_cast<uint32_t>(numPoolStrands);
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, strandCullPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, strandCullPipelineLayout, 0, 1, &cameraDescriptorSet, 0, nullptr);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, strandCullPipelineLayout, 1, 1, &hairDescriptorSets[slot], 0, nullptr);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, strandCullPipelineLayout, 2, 1, &shadowCameraDescriptorSet, 0, nullptr);
+    vkCmdPushConstants(commandBuffer, strandCullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &numStrands);
+    vkCmdDispatch(commandBuffer, (numStrands + STRAND_CULL_WORKGROUP_SIZE - 1) / STRAND_CULL_WORKGROUP_SIZE, 1, 1);
+
+    // The hair passes draw from the lists
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
 
-    VkSubmitInfo computeSubmitInfo = {};
-    computeSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-    computeSubmitInfo.commandBufferCount = 1;
-    computeSubmitInfo.pCommandBuffers = &computeCommandBuffer;
+void Renderer::RecordGraphicsUniformUpload(int frame) {
+    VkCommandBuffer commandBuffer = graphicsUploadCommandBuffers[frame];
 
-    if (vkQueueSubmit(device->GetQueue(QueueFlags::Compute), 1, &computeSubmitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to submit draw command buffer");
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to begin recording command buffer");
+    }
+
+    // The draws and the cull pass of the frame before may still read the old values
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_UNIFORM_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    vkCmdUpdateBuffer(commandBuffer, camera->GetBuffer(), 0, sizeof(CameraBufferObject), &camera->GetBufferObject());
+    vkCmdUpdateBuffer(commandBuffer, shadowCamera->GetBuffer(), 0, sizeof(CameraBufferObject), &shadowCamera->GetBufferObject());
+    vkCmdUpdateBuffer(commandBuffer, scene->GetRenderTimeBuffer(), 0, sizeof(Time), &scene->GetTime());
+    if (!scene->GetModelMatrices().empty()) {
+        vkCmdUpdateBuffer(commandBuffer, scene->GetModelBuffer(), 0, scene->GetModelMatrices().size() * sizeof(ModelBufferObject), scene->GetModelMatrices().data());
+    }
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to record command buffer");
+    }
+}
+
+
+void Renderer::RecordComputeUniformUpload(int frame) {
+    VkCommandBuffer commandBuffer = computeUploadCommandBuffers[frame];
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to begin recording command buffer");
+    }
+
+    // Same for the simulation frame before, the colliders and simulation LODs are read as storage buffers and the
+    // LODs as indirect dispatches too
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    vkCmdUpdateBuffer(commandBuffer, scene->GetTimeBuffer(), 0, sizeof(Time), &scene->GetTime());
+    vkCmdUpdateBuffer(commandBuffer, scene->GetCollidersBuffer(), 0, scene->GetCollidersDataSize(), scene->GetCollidersData());
+    vkCmdUpdateBuffer(commandBuffer, lodBuffer, 0, sizeof(SimulationLod), &simulationLod);
+    if (!simulationLodGroups.empty()) {
+        vkCmdUpdateBuffer(commandBuffer, lodBuffer, sizeof(SimulationLod), simulationLodGroups.size() * sizeof(SimulationLodGroup), simulationLodGroups.data());
     }
 
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to record command buffer");
+    }
+}
+
+
+void Renderer::SelectSimulationLods() {
+    const std::vector<Hair*>& hair = scene->GetHair();
+    std::vector<int> levels(hair.size(), 0);
+
+    if (simulationLodEnabled) {
+        // The coarsest level that still has a guide for every SIMULATION_LOD_PIXELS_PER_GUIDE pixels the hair's
+        // bounds cover on screen. Full detail once the camera is inside them
+        const CameraBufferObject& cameraObject = camera->GetBufferObject();
+        const float viewportHeight = static_cast<float>(swapChain->GetVkExtent().height);
+        for (size_t i = 0; i < hair.size(); ++i) {
+            glm::vec4 sphere = hair[i]->GetBoundingSphere();
+            float depth = -(cameraObject.viewMatrix * glm::vec4(glm::vec3(sphere), 1.0f)).z;
+            if (depth <= sphere.w) {
+                continue;
+            }
+
+            float pixelRadius = sphere.w / depth * std::abs(cameraObject.projectionMatrix[1][1]) * 0.5f * viewportHeight;
+            float wantedGuides = 3.14159265f * pixelRadius * pixelRadius / SIMULATION_LOD_PIXELS_PER_GUIDE;
+            while (levels[i] + 1 < NUM_SIMULATION_LODS && hair[i]->GetNumLodGuides(levels[i] + 1) >= wantedGuides) {
+                ++levels[i];
+            }
+        }
+
+        // Then make the hair simulating the most guides coarser until they all fit in the budget
+        while (simulationStrandBudget > 0) {
+            int totalGuides = 0;
+            int largest = -1;
+            for (size_t i = 0; i < hair.size(); ++i) {
+                int guides = hair[i]->GetNumLodGuides(levels[i]);
+                totalGuides += guides;
+                if (levels[i] + 1 < NUM_SIMULATION_LODS && (largest < 0 || guides > hair[largest]->GetNumLodGuides(levels[largest]))) {
+                    largest = static_cast<int>(i);
+                }
+            }
+            if (totalGuides <= simulationStrandBudget || largest < 0) {
+                break;
+            }
+            ++levels[largest];
+        }
+    }
+
+    // Each group's guides and interpolated strands come after those of the groups before it, and its lod strands
+    // after their NUM_SIMULATION_LODS levels
+    simulationLodGroups.resize(hair.size());
+    uint32_t numGuides = 0;
+    uint32_t numInterpolated = 0;
+    for (size_t i = 0; i < hair.size(); ++i) {
+        SimulationLodGroup& group = simulationLodGroups[i];
+        group.firstStrand = hairGroups[i].firstStrand;
+        group.numStrands = hairGroups[i].numStrands;
+        group.level = levels[i];
+        group.solver = static_cast<uint32_t>(hair[i]->GetSolver());
+        group.firstLodStrand = NUM_SIMULATION_LODS * group.firstStrand + hair[i]->GetFirstLodStrand(levels[i]);
+        group.numGuides = hair[i]->GetNumLodGuides(levels[i]);
+        group.firstGuide = numGuides;
+        group.firstInterpolated = numInterpolated;
+        numGuides += group.numGuides;
+        numInterpolated += group.numStrands - group.numGuides;
+    }
+    simulationLod = MakeSimulationLod(numGuides, numInterpolated);
+}
+
+
+SimulationLod Renderer::MakeSimulationLod(uint32_t numGuides, uint32_t numInterpolated) const {
+    const uint32_t numInterpolatedPoints = numInterpolated * numCurvePoints;
+
+    auto groups = [](uint32_t invocations, uint32_t workgroupSize) {
+        return glm::uvec4((invocations + workgroupSize - 1) / workgroupSize, 1, 1, 0);
+    };
+
+    SimulationLod lod = {};
+    lod.numGuides = numGuides;
+    lod.numInterpolated = numInterpolated;
+    lod.numGroups = static_cast<uint32_t>(simulationLodGroups.size());
+    lod.restSteps = simulationLodEnabled ? REST_STEPS : 0;
+    lod.dispatches[LOD_DISPATCH_COMPACT_AWAKE] = groups(numGuides, COMPUTE_WORKGROUP_SIZES[COMPACT_AWAKE_STAGE]);
+    lod.dispatches[LOD_DISPATCH_INTERPOLATE] = groups(numInterpolatedPoints, COMPUTE_WORKGROUP_SIZES[INTERPOLATE_STAGE]);
+
+    // compactAwake sums the dispatches over the awake guides up from these
+    const uint32_t guidePoints = numCurvePoints - 1;
+    lod.awakeWorkgroups[AWAKE_DISPATCH_INTEGRATE] = glm::uvec4(1, COMPUTE_WORKGROUP_SIZES[INTEGRATE_STAGE], 0, 0);
+    lod.awakeWorkgroups[AWAKE_DISPATCH_INTEGRATE_STRAND_GROUP] = glm::uvec4(1, strandGroupWorkgroupSize / numCurvePoints, 0, 0);
+    lod.awakeWorkgroups[AWAKE_DISPATCH_GRID_ALLOCATE] = glm::uvec4(guidePoints, COMPUTE_WORKGROUP_SIZES[GRID_ALLOCATE_STAGE], 0, 0);
+    lod.awakeWorkgroups[AWAKE_DISPATCH_SORT_KEYS] = glm::uvec4(guidePoints, COMPUTE_WORKGROUP_SIZES[SORT_POINTS_STAGE], 0, 0);
+    lod.awakeWorkgroups[AWAKE_DISPATCH_SORT_TILES] = glm::uvec4(guidePoints, POINT_SORT_TILE, 0, 0);
+    lod.awakeWorkgroups[AWAKE_DISPATCH_PARTICLE_TO_GRID] = glm::uvec4(guidePoints, COMPUTE_WORKGROUP_SIZES[PARTICLE_TO_GRID_STAGE], 0, 0);
+    lod.awakeWorkgroups[AWAKE_DISPATCH_GRID_TO_PARTICLE] = glm::uvec4(guidePoints, COMPUTE_WORKGROUP_SIZES[GRID_TO_PARTICLE_STAGE], 0, 0);
+    return lod;
+}
+
+
+void Renderer::RecordPointSort(VkCommandBuffer commandBuffer) {
+    // Every dispatch reads what the one before it wrote to the pool's sort buffers
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    // Keys of every simulated point, with computePipelines[SORT_POINTS_STAGE] and the pool already bound. Only the
+    // awake guides of the groups' simulation LODs have them, so the dispatches come from the awake strands
+    vkCmdDispatchIndirect(commandBuffer, awakeStrandsBuffer, AwakeDispatchOffset(AWAKE_DISPATCH_SORT_KEYS));
+
+    // Least significant digit first, each pass stable so the earlier digits stay in order
+    for (uint32_t pass = 0; pass < POINT_SORT_PASSES; ++pass) {
+        vkCmdPushConstants(commandBuffer, computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, offsetof(SimulationPushConstants, sortPass), sizeof(uint32_t), &pass);
+
+        for (VkPipeline pipeline : { sortHistogramPipeline, sortScanPipeline, sortScatterPipeline }) {
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+            vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+            if (pipeline == sortScanPipeline) {
+                vkCmdDispatch(commandBuffer, 1, 1, 1);
+            }
+            else {
+                vkCmdDispatchIndirect(commandBuffer, awakeStrandsBuffer, AwakeDispatchOffset(AWAKE_DISPATCH_SORT_TILES));
+            }
+        }
+    }
+}
+
+
+void Renderer::Frame() {
+    // Wait for the GPU to finish the last frame that used this frame's fences and upload command buffers. That
+    // also covers every draw of the slot the simulation is about to write, see NUM_DRAW_SLOTS
+    const int frame = swapChain->GetFrameIndex();
+    VkFence frameFences[] = { renderFences[frame], computeFences[frame] };
+    vkWaitForFences(logicalDevice, 2, frameFences, VK_TRUE, std::numeric_limits<uint64_t>::max());
+
+    // Pick up the stage timings of an earlier simulation frame if the GPU is done with it
+    if (computeQueryPool != VK_NULL_HANDLE) {
+        std::array<uint64_t, NUM_ACTIVE_COMPUTE_STAGES + 1> timestamps;
+        if (vkGetQueryPoolResults(logicalDevice, computeQueryPool, 0, NUM_ACTIVE_COMPUTE_STAGES + 1, sizeof(timestamps), timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+            for (int stage = 0; stage < NUM_ACTIVE_COMPUTE_STAGES; ++stage) {
+                computeStageTimes[stage] = (timestamps[stage + 1] - timestamps[stage]) * timestampPeriod * 1e-6f;
+            }
+        }
+    }
+
+    // Acquire before simulating, so a frame that bails out leaves no semaphore signalled that nothing waits on.
+    // The substeps the scene asked for this frame are dropped then
     if (!swapChain->Acquire()) {
         RecreateFrameResources();
         return;
     }
 
-    // Submit the command buffer
+    // Run however many fixed substeps the scene's accumulator asked for, if any, into the oldest slot. The compute
+    // queue works on them while the graphics queue draws the result of an earlier simulation frame
+    const int numSubsteps = scene->GetNumSubsteps();
+    const int writeSlot = (drawSlot + 1) % NUM_DRAW_SLOTS;
+
+    if (numSubsteps > 0) {
+        SelectSimulationLods();
+        RecordComputeUniformUpload(frame);
+
+        VkCommandBuffer submitComputeCommandBuffers[] = { computeUploadCommandBuffers[frame], computeCommandBuffers[writeSlot * scene->GetMaxSubsteps() + numSubsteps - 1] };
+
+        VkSubmitInfo computeSubmitInfo = {};
+        computeSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+
+        computeSubmitInfo.commandBufferCount = 2;
+        computeSubmitInfo.pCommandBuffers = submitComputeCommandBuffers;
+
+        computeSubmitInfo.signalSemaphoreCount = 1;
+        computeSubmitInfo.pSignalSemaphores = &simulationFinishedSemaphores[writeSlot];
+
+        vkResetFences(logicalDevice, 1, &computeFences[frame]);
+        if (vkQueueSubmit(device->GetQueue(QueueFlags::Compute), 1, &computeSubmitInfo, computeFences[frame]) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to submit draw command buffer");
+        }
+    }
+
+    // Submit the command buffer after this frame's uniforms, and behind the acquire of the draw slot if the
+    // simulation only just wrote it
+    RecordGraphicsUniformUpload(frame);
+
     VkSubmitInfo submitInfo = {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-    VkSemaphore waitSemaphores[] = { swapChain->GetImageAvailableVkSemaphore() };
-    VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-    submitInfo.waitSemaphoreCount = 1;
+    VkSemaphore waitSemaphores[] = { swapChain->GetImageAvailableVkSemaphore(), simulationFinishedSemaphores[drawSlot] };
+    VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT };
+    submitInfo.waitSemaphoreCount = drawSlotPending ? 2 : 1;
     submitInfo.pWaitSemaphores = waitSemaphores;
     submitInfo.pWaitDstStageMask = waitStages;
 
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffers[swapChain->GetIndex()];
+    std::vector<VkCommandBuffer> submitCommandBuffers = { graphicsUploadCommandBuffers[frame] };
+    if (drawSlotPending && separateComputeFamily) {
+        submitCommandBuffers.push_back(drawSlotAcquireCommandBuffers[drawSlot]);
+    }
+    submitCommandBuffers.push_back(commandBuffers[drawSlot * swapChain->GetCount() + swapChain->GetIndex()]);
+    submitInfo.commandBufferCount = static_cast<uint32_t>(submitCommandBuffers.size());
+    submitInfo.pCommandBuffers = submitCommandBuffers.data();
 
     VkSemaphore signalSemaphores[] = { swapChain->GetRenderFinishedVkSemaphore() };
     submitInfo.signalSemaphoreCount = 1;
     submitInfo.pSignalSemaphores = signalSemaphores;
 
-    if (vkQueueSubmit(device->GetQueue(QueueFlags::Graphics), 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+    vkResetFences(logicalDevice, 1, &renderFences[frame]);
+    if (vkQueueSubmit(device->GetQueue(QueueFlags::Graphics), 1, &submitInfo, renderFences[frame]) != VK_SUCCESS) {
         throw std::runtime_error("Failed to submit draw command buffer");
     }
 
+    // The next frame draws what this one simulated
+    drawSlotPending = false;
+    if (numSubsteps > 0) {
+        drawSlot = writeSlot;
+        drawSlotPending = true;
+    }
+
     if (!swapChain->Present()) {
         RecreateFrameResources();
     }
 }
 
 
+const std::array<float, NUM_COMPUTE_STAGES>& Renderer::GetComputeStageTimes() const {
+    return computeStageTimes;
+}
+
+
+bool Renderer::UsesFloatGridAtomics() const {
+    return floatGridAtomics;
+}
+
+
+void Renderer::SetSimulationLodEnabled(bool enabled) {
+    simulationLodEnabled = enabled;
+}
+
+
+void Renderer::SetSimulationStrandBudget(int budget) {
+    simulationStrandBudget = budget;
+}
+
+
+void Renderer::ReadStrands(size_t group, std::vector<Strand>& strands) const {
+    std::vector<glm::vec4> positions(simulationPositionsSize / sizeof(glm::vec4));
+    std::vector<glm::vec4> velocities(simulationPositionsSize / sizeof(glm::vec4));
+    BufferUtils::ReadBufferData(device, graphicsCommandPool, simulationPositionsBuffer, simulationPositionsSize, positions.data());
+    BufferUtils::ReadBufferData(device, graphicsCommandPool, simulationVelocitiesBuffer, simulationPositionsSize, velocities.data());
+
+    const int firstStrand = hairGroups[group].firstStrand;
+    strands.resize(hairGroups[group].numStrands);
+    for (size_t i = 0; i < strands.size(); ++i) {
+        const size_t first = (firstStrand + i) * numCurvePoints;
+        strands[i].curvePoints.assign(positions.begin() + first, positions.begin() + first + numCurvePoints);
+        strands[i].curveVels.assign(velocities.begin() + first, velocities.begin() + first + numCurvePoints);
+    }
+}
+
+
+bool Renderer::SortsGridPoints() const {
+    return sortGridPoints;
+}
+
+
+void Renderer::SetFloatGridAtomics(bool enabled) {
+#ifdef VK_EXT_shader_atomic_float
+    enabled = enabled && device->GetInstance()->IsDeviceExtensionEnabled(VK_EXT_SHADER_ATOMIC_FLOAT_EXTENSION_NAME);
+#else
+    enabled = false;
+#endif
+    if (enabled == floatGridAtomics) {
+        return;
+    }
+
+    // Both kinds of sums are zero between steps, so the grid carries over as it is
+    vkDeviceWaitIdle(logicalDevice);
+    DestroyComputeStagePipelines();
+    floatGridAtomics = enabled;
+    CreateComputeStagePipelines();
+
+    vkFreeCommandBuffers(logicalDevice, computeCommandPool, static_cast<uint32_t>(computeCommandBuffers.size()), computeCommandBuffers.data());
+    RecordComputeCommandBuffer();
+}
+
+
 Renderer::~Renderer() {
     vkDeviceWaitIdle(logicalDevice);
 
     vkFreeCommandBuffers(logicalDevice, graphicsCommandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
-    vkFreeCommandBuffers(logicalDevice, computeCommandPool, 1, &computeCommandBuffer);
+    vkFreeCommandBuffers(logicalDevice, computeCommandPool, static_cast<uint32_t>(computeCommandBuffers.size()), computeCommandBuffers.data());
+    if (separateComputeFamily) {
+        vkFreeCommandBuffers(logicalDevice, graphicsCommandPool, NUM_DRAW_SLOTS, drawSlotAcquireCommandBuffers.data());
+    }
+
+    vkFreeCommandBuffers(logicalDevice, graphicsCommandPool, MAX_FRAMES_IN_FLIGHT, graphicsUploadCommandBuffers.data());
+    vkFreeCommandBuffers(logicalDevice, computeCommandPool, MAX_FRAMES_IN_FLIGHT, computeUploadCommandBuffers.data());
+
+    for (VkSemaphore semaphore : simulationFinishedSemaphores) {
+        vkDestroySemaphore(logicalDevice, semaphore, nullptr);
+    }
+    for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        vkDestroyFence(logicalDevice, renderFences[frame], nullptr);
+        vkDestroyFence(logicalDevice, computeFences[frame], nullptr);
+    }
     
 	vkDestroyPipeline(logicalDevice, shadowMapPipeline, nullptr);
 	vkDestroyPipeline(logicalDevice, opacityMapPipeline, nullptr);
     vkDestroyPipeline(logicalDevice, graphicsPipeline, nullptr);
     vkDestroyPipeline(logicalDevice, hairPipeline, nullptr);
-    vkDestroyPipeline(logicalDevice, computePipeline, nullptr);
+    vkDestroyPipeline(logicalDevice, strandCullPipeline, nullptr);
+    DestroyComputeStagePipelines();
 
     vkDestroyPipelineLayout(logicalDevice, shadowMapPipelineLayout, nullptr);
     vkDestroyPipelineLayout(logicalDevice, opacityMapPipelineLayout, nullptr);
     vkDestroyPipelineLayout(logicalDevice, graphicsPipelineLayout, nullptr);
     vkDestroyPipelineLayout(logicalDevice, hairPipelineLayout, nullptr);
+    vkDestroyPipelineLayout(logicalDevice, strandCullPipelineLayout, nullptr);
     vkDestroyPipelineLayout(logicalDevice, computePipelineLayout, nullptr);
 
     vkDestroyDescriptorSetLayout(logicalDevice, cameraDescriptorSetLayout, nullptr);
@@ -2379,6 +3603,25 @@ Renderer::~Renderer() {
 
     vkDestroyDescriptorPool(logicalDevice, descriptorPool, nullptr);
 
+    for (int slot = 0; slot < NUM_DRAW_SLOTS; ++slot) {
+        vkDestroyBuffer(logicalDevice, poolPositionsBuffers[slot], nullptr);
+        vkFreeMemory(logicalDevice, poolPositionsBufferMemories[slot], nullptr);
+        vkDestroyBuffer(logicalDevice, poolPrevPositionsBuffers[slot], nullptr);
+        vkFreeMemory(logicalDevice, poolPrevPositionsBufferMemories[slot], nullptr);
+    }
+    for (VkBuffer buffer : { simulationPositionsBuffer, simulationVelocitiesBuffer, sortKeysBuffer, sortedPointsBuffer, sortHistogramsBuffer, lodBuffer, lodStrandsBuffer, lodNeighborsBuffer, awakeStrandsBuffer, restingStepsBuffer }) {
+        vkDestroyBuffer(logicalDevice, buffer, nullptr);
+    }
+    for (VkDeviceMemory memory : { simulationPositionsBufferMemory, simulationVelocitiesBufferMemory, sortKeysBufferMemory, sortedPointsBufferMemory, sortHistogramsBufferMemory, lodBufferMemory, lodStrandsBufferMemory, lodNeighborsBufferMemory, awakeStrandsBufferMemory, restingStepsBufferMemory }) {
+        vkFreeMemory(logicalDevice, memory, nullptr);
+    }
+    vkDestroyBuffer(logicalDevice, culledStrandsBuffer, nullptr);
+    vkFreeMemory(logicalDevice, culledStrandsBufferMemory, nullptr);
+
+    if (computeQueryPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(logicalDevice, computeQueryPool, nullptr);
+    }
+
 	vkDestroyRenderPass(logicalDevice, shadowMapRenderPass, nullptr);
 	vkDestroyRenderPass(logicalDevice, opacityMapRenderPass, nullptr);
     vkDestroyRenderPass(logicalDevice, renderPass, nullptr);
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <array>
+#include <string>
 #include "Device.h"
 #include "SwapChain.h"
 #include "Scene.h"
@@ -8,15 +10,43 @@
 const float SHADOW_MAP_WIDTH = 600;
 const float SHADOW_MAP_HEIGHT = 600;
 
+// Simulation dispatches in the order they run each substep. packPositions only runs with PACK_STRAND_POSITIONS,
+// sortPoints records nothing unless the renderer sorts the grid transfers' points. interpolate fills in the strands
+// the simulation LODs of the hair groups leave out, after compactAwake picked the guides that aren't resting for the stages
+// from integrate to gridToParticle
+enum ComputeStage {
+    COMPACT_AWAKE_STAGE,
+    INTEGRATE_STAGE,
+    GRID_BOUNDS_STAGE,
+    GRID_ALLOCATE_STAGE,
+    SORT_POINTS_STAGE,
+    PARTICLE_TO_GRID_STAGE,
+    GRID_NORMALIZE_STAGE,
+    GRID_TO_PARTICLE_STAGE,
+    GRID_RELEASE_STAGE,
+    INTERPOLATE_STAGE,
+    PACK_POSITIONS_STAGE,
+};
+constexpr static int NUM_COMPUTE_STAGES = PACK_POSITIONS_STAGE + 1;
+const std::array<const char*, NUM_COMPUTE_STAGES> COMPUTE_STAGE_NAMES = { "compactAwake", "integrate", "gridBounds", "gridAllocate", "sortPoints", "particleToGrid", "gridNormalize", "gridToParticle", "gridRelease", "interpolate", "packPositions" };
+
 class Renderer {
 public:
+    // Specialization constants shared by the hair pipelines: 0 = render positions are packed, 1 = curve points per strand
+    struct HairSpecialization {
+        VkBool32 packedPositions;
+        int32_t numCurvePoints;
+        float packedPositionScale;
+    };
+
     Renderer() = delete;
-    Renderer(Device* device, SwapChain* swapChain, Scene* scene, Camera* camera, Camera* shadowCamera);
+    Renderer(Device* device, SwapChain* swapChain, Scene* scene, Camera* camera, Camera* shadowCamera, bool sortGridPoints = false);
     ~Renderer();
 
 	Scene* scene;
 
     void CreateCommandPools();
+    void CreateStrandPool();
 
     void CreateRenderPass();
 	void CreateShadowMapRenderPass();
@@ -39,8 +69,7 @@ public:
     void CreateTextureDescriptorSets();
     void CreateShadowCameraDescriptorSet();
     void CreateHairDescriptorSets();
-    void CreateOpacityMapDescriptorSets();
-    void CreateOpacityMapHairDescriptorSets();
+    void CreateOpacityMapDescriptorSet();
     void CreateTimeDescriptorSet();
     void CreateCollidersDescriptorSets();
 	void CreateGridDescriptorSets();
@@ -50,7 +79,14 @@ public:
 	void CreateOpacityMapPipeline();
     void CreateGraphicsPipeline();
     void CreateHairPipeline();
+    void CreateStrandCullPipeline();
     void CreateComputePipeline();
+    void CreateComputeStagePipelines();
+    void DestroyComputeStagePipelines();
+    VkPipeline CreateComputeStagePipeline(const std::string& shaderFilename, uint32_t workgroupSize);
+    void CreateComputeQueryPool();
+    void CreateSyncObjects();
+    void TransferSimulationResources();
 
 	void CreateShadowMapFrameResources();
 	void CreateOpacityMapFrameResources();
@@ -61,10 +97,34 @@ public:
     void RecreateFrameResources();
 
     void RecordCommandBuffers();
+    void RecordStrandCull(VkCommandBuffer commandBuffer, int slot);
     void RecordComputeCommandBuffer();
+    void RecordPointSort(VkCommandBuffer commandBuffer);
+    void RecordDrawSlotAcquires();
+    void RecordGraphicsUniformUpload(int frame);
+    void RecordComputeUniformUpload(int frame);
+    void SelectSimulationLods();
+    SimulationLod MakeSimulationLod(uint32_t numGuides, uint32_t numInterpolated) const;
 
     void Frame();
 
+    // GPU time in milliseconds of each compute stage during the last substep of the latest finished simulation frame
+    const std::array<float, NUM_COMPUTE_STAGES>& GetComputeStageTimes() const;
+    bool UsesFloatGridAtomics() const;
+    bool SortsGridPoints() const;
+
+    // Rebuilds the simulation stages with float atomic or fixed point grid sums, to compare the two in one run.
+    // Float sums stay off unless the device has the extension enabled
+    void SetFloatGridAtomics(bool enabled);
+
+    // Off simulates every strand of every hair, every step. On lets guides rest and picks each hair's level from the pixels it covers, then
+    // coarsens the hair simulating the most guides while they add up to more than the budget, 0 for no budget
+    void SetSimulationLodEnabled(bool enabled);
+    void SetSimulationStrandBudget(int budget);
+
+    // Simulation state of the strands of scene->GetHair()[group], read back from the strand pool
+    void ReadStrands(size_t group, std::vector<Strand>& strands) const;
+
 private:
     Device* device;
     VkDevice logicalDevice;
@@ -72,9 +132,25 @@ private:
     Camera* camera;
     Camera* shadowCamera;
 
+    // Curve points per strand of every hair in the scene, baked into the hair and compute pipelines
+    int numCurvePoints;
+
+    // particleToGrid sums into the grid with float atomics instead of fixed point
+    bool floatGridAtomics = false;
+
+    // Radix sort the simulated curve points by grid cell before particleToGrid, which then visits them through
+    // the hair's sorted points instead of in strand order
+    bool sortGridPoints;
+    HairSpecialization hairSpecialization;
+    VkSpecializationInfo hairSpecializationInfo = {};
+
     VkCommandPool graphicsCommandPool;
     VkCommandPool computeCommandPool;
 
+    // The compute queue is from another family than the graphics one, so what one writes for the other changes
+    // owner with a release on one queue and an acquire on the other
+    bool separateComputeFamily;
+
     VkRenderPass renderPass;
     VkRenderPass shadowMapRenderPass;
     VkRenderPass opacityMapRenderPass;
@@ -96,24 +172,100 @@ private:
     VkDescriptorSet shadowCameraDescriptorSet;
 	std::vector<VkDescriptorSet> hairDescriptorSets;
 	VkDescriptorSet modelDescriptorSet;
-	std::vector<VkDescriptorSet> opacityMapDescriptorSets;
-	std::vector<VkDescriptorSet> opacityMapHairDescriptorSets;
+	VkDescriptorSet opacityMapDescriptorSet;
     VkDescriptorSet timeDescriptorSet;
 	VkDescriptorSet collidersDescriptorSets;
 	VkDescriptorSet gridDescriptorSets;
-	std::vector<VkDescriptorSet> computeDescriptorSets;
+	std::array<VkDescriptorSet, NUM_DRAW_SLOTS> computeDescriptorSets = {};
+	std::array<VkDescriptorSet, NUM_DRAW_SLOTS> prevComputeDescriptorSets = {};
 
     VkPipelineLayout graphicsPipelineLayout;
     VkPipelineLayout shadowMapPipelineLayout;
     VkPipelineLayout opacityMapPipelineLayout;
     VkPipelineLayout hairPipelineLayout;
+    VkPipelineLayout strandCullPipelineLayout;
     VkPipelineLayout computePipelineLayout;
 
     VkPipeline graphicsPipeline;
     VkPipeline shadowMapPipeline;
     VkPipeline opacityMapPipeline;
     VkPipeline hairPipeline;
-    VkPipeline computePipeline;
+
+    // Culls the strand pool against the camera and the light at the start of the frame's command buffer, leaving
+    // the hair passes their visible strands and draws
+    VkPipeline strandCullPipeline;
+    std::array<VkPipeline, NUM_COMPUTE_STAGES> computePipelines = {};
+
+    // Replaces the integrate stage for hair using StrandSolver::WorkgroupPerStrand
+    VkPipeline integrateStrandGroupPipeline = VK_NULL_HANDLE;
+    uint32_t strandGroupWorkgroupSize = 0;
+
+    // Radix passes of the point sort, after computePipelines[SORT_POINTS_STAGE] makes the keys. Only created
+    // when sorting
+    VkPipeline sortHistogramPipeline = VK_NULL_HANDLE;
+    VkPipeline sortScanPipeline = VK_NULL_HANDLE;
+    VkPipeline sortScatterPipeline = VK_NULL_HANDLE;
+
+    // Timestamps around each compute stage, VK_NULL_HANDLE if the compute queue can't write them
+    VkQueryPool computeQueryPool = VK_NULL_HANDLE;
+    float timestampPeriod = 0.0f;
+    std::array<float, NUM_COMPUTE_STAGES> computeStageTimes = {};
+
+    bool simulationLodEnabled = true;
+    int simulationStrandBudget = 0;
+
+    // Levels of the hair groups for the next simulation frame, what RecordComputeUniformUpload writes to the lod
+    // buffer
+    SimulationLod simulationLod = {};
+    std::vector<SimulationLodGroup> simulationLodGroups;
+
+    // Render positions of every hair group one after the other, so the cull pass and each hair pass cover them all
+    // with a single dispatch and draw. packPositions writes them straight into the pool of the draw slot the compute
+    // command buffer fills, the unpacked positions are copied there from the simulation's
+    int numPoolStrands = 0;
+    std::vector<HairGroup> hairGroups;
+    VkDeviceSize poolPositionsSize = 0;
+    std::array<VkBuffer, NUM_DRAW_SLOTS> poolPositionsBuffers = {};
+    std::array<VkDeviceMemory, NUM_DRAW_SLOTS> poolPositionsBufferMemories = {};
+    std::array<VkBuffer, NUM_DRAW_SLOTS> poolPrevPositionsBuffers = {};
+    std::array<VkDeviceMemory, NUM_DRAW_SLOTS> poolPrevPositionsBufferMemories = {};
+
+    // Simulation state of the pool, group g's strands from hairGroups[g].firstStrand on as in the render positions,
+    // so each simulation stage covers every group with one dispatch. The lod strands and neighbors of each group
+    // follow those of the group before it, in pool strand indices, and the lod buffer holds simulationLod and
+    // simulationLodGroups
+    VkBuffer simulationPositionsBuffer;
+    VkBuffer simulationVelocitiesBuffer;
+    VkBuffer sortKeysBuffer;
+    VkBuffer sortedPointsBuffer;
+    VkBuffer sortHistogramsBuffer;
+    VkBuffer lodBuffer;
+    VkBuffer lodStrandsBuffer;
+    VkBuffer lodNeighborsBuffer;
+    VkBuffer awakeStrandsBuffer;
+    VkBuffer restingStepsBuffer;
+    VkDeviceMemory simulationPositionsBufferMemory;
+    VkDeviceMemory simulationVelocitiesBufferMemory;
+    VkDeviceMemory sortKeysBufferMemory;
+    VkDeviceMemory sortedPointsBufferMemory;
+    VkDeviceMemory sortHistogramsBufferMemory;
+    VkDeviceMemory lodBufferMemory;
+    VkDeviceMemory lodStrandsBufferMemory;
+    VkDeviceMemory lodNeighborsBufferMemory;
+    VkDeviceMemory awakeStrandsBufferMemory;
+    VkDeviceMemory restingStepsBufferMemory;
+    VkDeviceSize simulationPositionsSize = 0;
+    VkDeviceSize sortKeysSize = 0;
+    VkDeviceSize sortHistogramsSize = 0;
+    VkDeviceSize lodSize = 0;
+    VkDeviceSize lodStrandsSize = 0;
+    VkDeviceSize lodNeighborsSize = 0;
+    VkDeviceSize awakeStrandsSize = 0;
+    VkDeviceSize restingStepsSize = 0;
+
+    // CulledStrands of the pool, followed by NUM_CULL_VIEWS lists of numPoolStrands strand indices
+    VkBuffer culledStrandsBuffer;
+    VkDeviceMemory culledStrandsBufferMemory;
 
     std::vector<VkImageView> imageViews;
     VkImage depthImage;
@@ -133,6 +285,29 @@ private:
 	VkFramebuffer opacityMapFramebuffer;
 	VkSampler opacityMapSampler;
 
+    // commandBuffers[slot * swap chain images + image] draws from draw slot slot, computeCommandBuffers[slot *
+    // max substeps + n - 1] runs n substeps and leaves the result in draw slot slot
     std::vector<VkCommandBuffer> commandBuffers;
-    VkCommandBuffer computeCommandBuffer;
+    std::vector<VkCommandBuffer> computeCommandBuffers;
+
+    // Graphics side of the ownership transfer of each draw slot, submitted ahead of the first frame drawing it
+    std::array<VkCommandBuffer, NUM_DRAW_SLOTS> drawSlotAcquireCommandBuffers = {};
+
+    // Signalled by the simulation frame writing a draw slot, waited on by the first frame drawing it
+    std::array<VkSemaphore, NUM_DRAW_SLOTS> simulationFinishedSemaphores = {};
+
+    // Per frame in flight, re-recorded each time the frame comes around: the uniforms the frame's draws and
+    // simulation read, written into their device local buffers with vkCmdUpdateBuffer. The command buffer holds
+    // the copy, so the host never touches memory the GPU may be reading
+    std::array<VkCommandBuffer, MAX_FRAMES_IN_FLIGHT> graphicsUploadCommandBuffers = {};
+    std::array<VkCommandBuffer, MAX_FRAMES_IN_FLIGHT> computeUploadCommandBuffers = {};
+
+    // Signalled when the GPU is done with a frame in flight's draws and simulation. Waited on before its upload
+    // command buffers are recorded again
+    std::array<VkFence, MAX_FRAMES_IN_FLIGHT> renderFences = {};
+    std::array<VkFence, MAX_FRAMES_IN_FLIGHT> computeFences = {};
+
+    // Slot the next frame draws from, and whether it still has to wait for the simulation writing it
+    int drawSlot = 0;
+    bool drawSlotPending = false;
 };
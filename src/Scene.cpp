@@ -1,23 +1,114 @@
+#include <algorithm>
+#include <glm/gtc/packing.hpp>
 #include "Scene.h"
 #include "BufferUtils.h"
+#include "Image.h"
+
+Scene::Scene(Device* device, VkCommandPool commandPool, std::vector<Collider> colliders, std::vector<Model*> models, const Sdf& sdf) : device(device), colliders(colliders), models(models), sdf(sdf) {
+	// Fill time buffers
+	time.deltaTime = fixedDeltaTime;
+	BufferUtils::CreateBufferFromData(device, commandPool, &time, sizeof(Time), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, timeBuffer, timeBufferMemory);
+	BufferUtils::CreateBufferFromData(device, commandPool, &time, sizeof(Time), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, renderTimeBuffer, renderTimeBufferMemory);
+
+	// SDF collider, or a 2x2x2 placeholder so the descriptor always has an image
+	glm::ivec3 sdfDims = this->sdf.Empty() ? glm::ivec3(2) : this->sdf.dims;
+	std::vector<uint64_t> sdfTexels((size_t)sdfDims.x * sdfDims.y * sdfDims.z, glm::packHalf4x16(glm::vec4(0.0f, 1.0f, 0.0f, 1.0f)));
+	for (size_t i = 0; i < this->sdf.samples.size(); ++i) {
+		sdfTexels[i] = glm::packHalf4x16(this->sdf.samples[i]);
+	}
 
-Scene::Scene(Device* device, VkCommandPool commandPool, std::vector<Collider> colliders, std::vector<Model*> models) : device(device), colliders(colliders), models(models) {
-	// Fill time buffer
-	BufferUtils::CreateBuffer(device, sizeof(Time), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, timeBuffer, timeBufferMemory);
-    vkMapMemory(device->GetVkDevice(), timeBufferMemory, 0, sizeof(Time), 0, &mappedData);
-    memcpy(mappedData, &time, sizeof(Time));
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingBufferMemory;
+	VkDeviceSize sdfSize = sdfTexels.size() * sizeof(uint64_t);
+	BufferUtils::CreateBuffer(device, sdfSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+	void* stagingData;
+	vkMapMemory(device->GetVkDevice(), stagingBufferMemory, 0, sdfSize, 0, &stagingData);
+	memcpy(stagingData, sdfTexels.data(), static_cast<size_t>(sdfSize));
+	vkUnmapMemory(device->GetVkDevice(), stagingBufferMemory);
+
+	Image::Create3D(device, sdfDims.x, sdfDims.y, sdfDims.z, SDF_FORMAT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, sdfImage, sdfImageMemory);
+	Image::TransitionLayout(device, commandPool, sdfImage, SDF_FORMAT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+	Image::CopyFromBuffer(device, commandPool, stagingBuffer, sdfImage, sdfDims.x, sdfDims.y, sdfDims.z);
+	Image::TransitionLayout(device, commandPool, sdfImage, SDF_FORMAT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+	sdfImageView = Image::CreateView(device, sdfImage, SDF_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_3D);
+
+	vkDestroyBuffer(device->GetVkDevice(), stagingBuffer, nullptr);
+	vkFreeMemory(device->GetVkDevice(), stagingBufferMemory, nullptr);
+
+	// Trilinear, and points past the border get the border samples like Sdf::Sample
+	VkSamplerCreateInfo sdfSamplerInfo = {};
+	sdfSamplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	sdfSamplerInfo.magFilter = VK_FILTER_LINEAR;
+	sdfSamplerInfo.minFilter = VK_FILTER_LINEAR;
+	sdfSamplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sdfSamplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sdfSamplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	sdfSamplerInfo.anisotropyEnable = VK_FALSE;
+	sdfSamplerInfo.maxAnisotropy = 1.0f;
+	sdfSamplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
+	sdfSamplerInfo.unnormalizedCoordinates = VK_FALSE;
+	sdfSamplerInfo.compareEnable = VK_FALSE;
+	sdfSamplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+	sdfSamplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+
+	if (vkCreateSampler(device->GetVkDevice(), &sdfSamplerInfo, nullptr, &sdfSampler) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create SDF sampler");
+	}
 
-	// Fill colliders buffer
-	BufferUtils::CreateBuffer(device, sizeof(Collider) * this->colliders.size(), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, collidersBuffer, collidersBufferMemory);
-	vkMapMemory(device->GetVkDevice(), collidersBufferMemory, 0, sizeof(Collider) * this->colliders.size(), 0, &mappedData2);
-	memcpy(mappedData2, this->colliders.data(), sizeof(Collider) * this->colliders.size());
+	// Fill colliders buffer. It has room for MAX_COLLIDERS, the header says how many are in use
+	if (this->colliders.size() > MAX_COLLIDERS) {
+		throw std::runtime_error("Failed to create colliders buffer: too many colliders");
+	}
+	UpdateCollidersBuffer();
+	std::vector<char> collidersBufferData(GetCollidersBufferSize(), 0);
+	memcpy(collidersBufferData.data(), GetCollidersData(), GetCollidersDataSize());
+	BufferUtils::CreateBufferFromData(device, commandPool, collidersBufferData.data(), GetCollidersBufferSize(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, collidersBuffer, collidersBufferMemory);
 
-	// Fill grid buffer
+	// Fill grid buffer. It starts out zeroed and gridNormalize leaves it that way. Same for the velocity image
+	// and gridRelease
 	this->grid = std::vector<GridCell>();
-	int d = 64;
-	grid.resize(d * d * d, GridCell(glm::ivec3(0), 0));
+	grid.resize(GRID_MAX_BRICKS * GRID_BRICK_CELLS, GridCell(glm::ivec3(0), 0));
+
+	BufferUtils::CreateBufferFromData(device, commandPool, grid.data(), grid.size() * sizeof(GridCell), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, gridBuffer, gridBufferMemory);
+
+	Image::Create3D(device, GRID_DIM, GRID_DIM, GRID_DIM, GRID_VELOCITY_FORMAT, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, gridVelocityImage, gridVelocityImageMemory);
+	Image::TransitionLayout(device, commandPool, gridVelocityImage, GRID_VELOCITY_FORMAT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+	Image::Clear(device, commandPool, gridVelocityImage, VK_IMAGE_LAYOUT_GENERAL, VkClearColorValue {});
+	gridVelocityImageView = Image::CreateView(device, gridVelocityImage, GRID_VELOCITY_FORMAT, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_VIEW_TYPE_3D);
+
+	// Trilinear like the grid transfers' weights, and zero outside the grid like the cells no point reached
+	VkSamplerCreateInfo samplerInfo = {};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
+	samplerInfo.anisotropyEnable = VK_FALSE;
+	samplerInfo.maxAnisotropy = 1.0f;
+	samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
+	samplerInfo.unnormalizedCoordinates = VK_FALSE;
+	samplerInfo.compareEnable = VK_FALSE;
+	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.mipLodBias = 0.0f;
+	samplerInfo.minLod = 0.0f;
+	samplerInfo.maxLod = 0.0f;
+
+	if (vkCreateSampler(device->GetVkDevice(), &samplerInfo, nullptr, &gridVelocitySampler) != VK_SUCCESS) {
+		throw std::runtime_error("Failed to create grid velocity sampler");
+	}
+
+	// Empty bounds, filled by the first step
+	GridBounds gridBounds = { glm::uvec4(0xFFFFFFFF), glm::uvec4(0) };
+	BufferUtils::CreateBufferFromData(device, commandPool, &gridBounds, sizeof(GridBounds), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, gridBoundsBuffer, gridBoundsBufferMemory);
 
-	BufferUtils::CreateBufferFromData(device, commandPool, grid.data(), grid.size() * sizeof(GridCell), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, gridBuffer, gridBufferMemory);
+	// No bricks allocated, and the dispatch it holds is numBricks x 1 x 1
+	std::vector<GridBricks> gridBricks(1);
+	memset(gridBricks.data(), 0, sizeof(GridBricks));
+	gridBricks[0].groupCountY = 1;
+	gridBricks[0].groupCountZ = 1;
+	BufferUtils::CreateBufferFromData(device, commandPool, gridBricks.data(), sizeof(GridBricks), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, gridBricksBuffer, gridBricksBufferMemory);
 
 	// Fill dynamic model matrix buffer
 	size_t minUboAlignment = sizeof(ModelBufferObject);
@@ -29,9 +120,7 @@ Scene::Scene(Device* device, VkCommandPool commandPool, std::vector<Collider> co
 		this->modelMatrices.push_back(this->models.at(i)->getModelBufferObject());
 	}
 
-	BufferUtils::CreateBuffer(device, this->models.size() * sizeof(ModelBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, modelBuffer, modelBufferMemory);
-	vkMapMemory(device->GetVkDevice(), modelBufferMemory, 0, sizeof(ModelBufferObject) * this->models.size(), 0, &mappedData3);
-	memcpy(mappedData3, this->modelMatrices.data(), sizeof(ModelBufferObject) * this->models.size());
+	BufferUtils::CreateBufferFromData(device, commandPool, this->modelMatrices.data(), this->models.size() * sizeof(ModelBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, modelBuffer, modelBufferMemory);
 }
 
 
@@ -50,6 +139,11 @@ const std::vector<Collider>& Scene::GetColliders() const {
 }
 
 
+const Sdf& Scene::GetSdf() const {
+	return sdf;
+}
+
+
 const std::vector<GridCell>& Scene::GetGrid() const {
 	return grid;
 }
@@ -71,7 +165,38 @@ void Scene::AddHair(Hair* hair) {
 
 
 void Scene::AddCollider(Collider collider) {
+	if (this->colliders.size() >= MAX_COLLIDERS) {
+		throw std::runtime_error("Failed to add collider: too many colliders");
+	}
 	this->colliders.push_back(collider);
+	UpdateCollidersBuffer();
+}
+
+
+void Scene::UpdateCollidersBuffer() {
+	CollidersHeader header = {};
+	header.numColliders = static_cast<uint32_t>(this->colliders.size());
+	header.sdfFrame = glm::vec4(this->sdf.origin, this->sdf.Empty() ? 0.0f : this->sdf.cellSize);
+	collidersData.resize((sizeof(CollidersHeader) + sizeof(Collider) * this->colliders.size()) / sizeof(uint32_t));
+	memcpy(collidersData.data(), &header, sizeof(CollidersHeader));
+	memcpy(reinterpret_cast<char*>(collidersData.data()) + sizeof(CollidersHeader), this->colliders.data(), sizeof(Collider) * this->colliders.size());
+}
+
+
+void Scene::SetTimeStep(float fixedDeltaTime, int maxSubsteps) {
+	this->fixedDeltaTime = fixedDeltaTime;
+	this->maxSubsteps = std::max(maxSubsteps, 1);
+	accumulator = 0.0f;
+}
+
+
+float Scene::GetFixedDeltaTime() const {
+	return fixedDeltaTime;
+}
+
+
+int Scene::GetMaxSubsteps() const {
+	return maxSubsteps;
 }
 
 
@@ -80,10 +205,35 @@ void Scene::UpdateTime() {
     duration<float> nextDeltaTime = duration_cast<duration<float>>(currentTime - startTime);
     startTime = currentTime;
 
-    time.deltaTime = nextDeltaTime.count();
-    time.totalTime += time.deltaTime;
+	// Drop time we can't catch up on (hitches, the first frame) instead of spiralling
+	accumulator += std::min(nextDeltaTime.count(), maxSubsteps * fixedDeltaTime);
+
+	numSubsteps = std::min((int)(accumulator / fixedDeltaTime), maxSubsteps);
+	accumulator -= numSubsteps * fixedDeltaTime;
+
+    time.deltaTime = fixedDeltaTime;
+    time.totalTime += numSubsteps * fixedDeltaTime;
+	time.alpha = std::min(accumulator / fixedDeltaTime, 1.0f);
+}
+
+
+void Scene::StepTime(int numSubsteps) {
+	this->numSubsteps = std::min(std::max(numSubsteps, 0), maxSubsteps);
+	accumulator = 0.0f;
+
+	time.deltaTime = fixedDeltaTime;
+	time.totalTime += this->numSubsteps * fixedDeltaTime;
+	time.alpha = 0.0f;
+}
+
+
+int Scene::GetNumSubsteps() const {
+	return numSubsteps;
+}
+
 
-    memcpy(mappedData, &time, sizeof(Time));
+const Time& Scene::GetTime() const {
+	return time;
 }
 
 
@@ -92,16 +242,76 @@ VkBuffer Scene::GetTimeBuffer() const {
 }
 
 
+VkBuffer Scene::GetRenderTimeBuffer() const {
+    return renderTimeBuffer;
+}
+
+
 VkBuffer Scene::GetCollidersBuffer() const {
 	return collidersBuffer;
 }
 
 
+VkDeviceSize Scene::GetCollidersBufferSize() const {
+	return sizeof(CollidersHeader) + MAX_COLLIDERS * sizeof(Collider);
+}
+
+
+const void* Scene::GetCollidersData() const {
+	return collidersData.data();
+}
+
+
+VkDeviceSize Scene::GetCollidersDataSize() const {
+	return collidersData.size() * sizeof(uint32_t);
+}
+
+
+VkImage Scene::GetSdfImage() const {
+	return sdfImage;
+}
+
+
+VkImageView Scene::GetSdfImageView() const {
+	return sdfImageView;
+}
+
+
+VkSampler Scene::GetSdfSampler() const {
+	return sdfSampler;
+}
+
+
 VkBuffer Scene::GetGridBuffer() const {
 	return gridBuffer;
 }
 
 
+VkImage Scene::GetGridVelocityImage() const {
+	return gridVelocityImage;
+}
+
+
+VkImageView Scene::GetGridVelocityImageView() const {
+	return gridVelocityImageView;
+}
+
+
+VkSampler Scene::GetGridVelocitySampler() const {
+	return gridVelocitySampler;
+}
+
+
+VkBuffer Scene::GetGridBoundsBuffer() const {
+	return gridBoundsBuffer;
+}
+
+
+VkBuffer Scene::GetGridBricksBuffer() const {
+	return gridBricksBuffer;
+}
+
+
 VkBuffer Scene::GetModelBuffer() const {
 	return modelBuffer;
 }
@@ -110,13 +320,7 @@ VkBuffer Scene::GetModelBuffer() const {
 void Scene::translateSphere(glm::vec3 translation) {
 	// Update colliders transformation
 	if (this->colliders.size() > 0) {
-		glm::mat4 currTransform = this->colliders.at(0).transform;
-		glm::mat4 newTransform = glm::translate(currTransform, translation);
-
-		this->colliders.at(0).transform = newTransform;
-		glm::mat4 inverse = glm::inverse(newTransform);
-		this->colliders.at(0).inv = inverse;
-		this->colliders.at(0).invTrans = glm::transpose(inverse);
+		this->colliders.at(0).Translate(translation);
 	}
 	// Update model matrix transformation
 	if (this->models.size() > 0) {
@@ -129,23 +333,37 @@ void Scene::translateSphere(glm::vec3 translation) {
 		this->modelMatrices.at(0) = this->models.at(0)->getModelBufferObject();
 
 	}
-	// Update buffers
-	memcpy(mappedData2, this->colliders.data(), sizeof(Collider) * this->colliders.size());
-	memcpy(mappedData3, this->modelMatrices.data(), sizeof(ModelBufferObject) * this->models.size());
+	// The renderer picks both up with the next frame
+	UpdateCollidersBuffer();
 
 }
 
 
 Scene::~Scene() {
-    vkUnmapMemory(device->GetVkDevice(), timeBufferMemory);
     vkDestroyBuffer(device->GetVkDevice(), timeBuffer, nullptr);
     vkFreeMemory(device->GetVkDevice(), timeBufferMemory, nullptr);
+    vkDestroyBuffer(device->GetVkDevice(), renderTimeBuffer, nullptr);
+    vkFreeMemory(device->GetVkDevice(), renderTimeBufferMemory, nullptr);
 
-	vkUnmapMemory(device->GetVkDevice(), collidersBufferMemory);
 	vkDestroyBuffer(device->GetVkDevice(), collidersBuffer, nullptr);
 	vkFreeMemory(device->GetVkDevice(), collidersBufferMemory, nullptr);
 
-	vkUnmapMemory(device->GetVkDevice(), modelBufferMemory);
+	vkDestroySampler(device->GetVkDevice(), sdfSampler, nullptr);
+	vkDestroyImageView(device->GetVkDevice(), sdfImageView, nullptr);
+	vkDestroyImage(device->GetVkDevice(), sdfImage, nullptr);
+	vkFreeMemory(device->GetVkDevice(), sdfImageMemory, nullptr);
+
+	vkDestroyBuffer(device->GetVkDevice(), gridBuffer, nullptr);
+	vkFreeMemory(device->GetVkDevice(), gridBufferMemory, nullptr);
+	vkDestroySampler(device->GetVkDevice(), gridVelocitySampler, nullptr);
+	vkDestroyImageView(device->GetVkDevice(), gridVelocityImageView, nullptr);
+	vkDestroyImage(device->GetVkDevice(), gridVelocityImage, nullptr);
+	vkFreeMemory(device->GetVkDevice(), gridVelocityImageMemory, nullptr);
+	vkDestroyBuffer(device->GetVkDevice(), gridBoundsBuffer, nullptr);
+	vkFreeMemory(device->GetVkDevice(), gridBoundsBufferMemory, nullptr);
+	vkDestroyBuffer(device->GetVkDevice(), gridBricksBuffer, nullptr);
+	vkFreeMemory(device->GetVkDevice(), gridBricksBufferMemory, nullptr);
+
 	vkDestroyBuffer(device->GetVkDevice(), modelBuffer, nullptr);
 	vkFreeMemory(device->GetVkDevice(), modelBufferMemory, nullptr);
 }
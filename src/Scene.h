@@ -4,40 +4,155 @@
 #define GLM_ENABLE_EXPERIMENTAL
 
 #include <glm/gtx/transform.hpp>
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 
 #include "Model.h"
 #include "Strand.h"
+#include "Sdf.h"
 
 #define DEG_TO_RAD 0.01745329251
 
 using namespace std::chrono;
 
+// Default simulation step and the most steps a single frame may run to catch up. Collisions are projected rather
+// than pushed out by penalty springs, so the step isn't bound by the spring stiffness
+constexpr static float FIXED_TIME_STEP = 1.0f / 60.0f;
+constexpr static int MAX_SUBSTEPS = 4;
+
 struct Time {
-    float deltaTime = 0.0f;
+    float deltaTime = 0.0f; // fixed simulation step
     float totalTime = 0.0f;
+    float alpha = 0.0f;     // how far rendering is between the previous and current simulated state
 };
 
 
-// Collider is ellipsoid
+// Most colliders the simulation takes, one bit each in the candidate masks of shaders/simulation.glsl
+constexpr static int MAX_COLLIDERS = 64;
+
+// Collider is an ellipsoid: a center and three orthonormal axes with the radius along each. Same layout as
+// Collider in shaders/simulation.glsl
 struct Collider {
-	glm::mat4 transform;
-	glm::mat4 inv;
-	glm::mat4 invTrans;
+	glm::vec4 center;  // w is the bounding radius, the largest of the radii
+	glm::vec4 axes[3];
+	glm::vec4 radii;
+	glm::vec4 previousCenter; // before the last Translate, for the swept collision test
 
 	Collider(glm::vec3 trans, glm::vec3 rot, glm::vec3 scale) {
-		glm::mat4 transMat = glm::translate(trans);
 		glm::mat4 rotXMat = glm::rotate(rot.x * (float)DEG_TO_RAD, glm::vec3(1.0, 0.0, 0.0));
 		glm::mat4 rotYMat = glm::rotate(rot.y * (float)DEG_TO_RAD, glm::vec3(0.0, 1.0, 0.0));
 		glm::mat4 rotZMat = glm::rotate(rot.z * (float)DEG_TO_RAD, glm::vec3(0.0, 0.0, 1.0));
-		glm::mat4 scaleMat = glm::scale(scale);
+		glm::mat4 rotMat = rotZMat * rotYMat * rotXMat;
+
+		this->center = glm::vec4(trans, std::max(std::max(scale.x, scale.y), scale.z));
+		for (int i = 0; i < 3; ++i) {
+			this->axes[i] = glm::vec4(glm::vec3(rotMat[i]), 0.0f);
+		}
+		this->radii = glm::vec4(scale, 0.0f);
+		this->previousCenter = this->center;
+	}
+
+	// Moves the collider by an offset along its own scaled axes. Called once a frame, even without an offset,
+	// so the simulation sweeps it over the motion of the last frame only
+	void Translate(glm::vec3 translation) {
+		this->previousCenter = this->center;
+		for (int i = 0; i < 3; ++i) {
+			this->center += this->axes[i] * this->radii[i] * translation[i];
+		}
+	}
+
+	// The collider over part substep of numSubsteps equal parts of the last Translate, so a frame that runs several
+	// substeps doesn't sweep the whole motion in each of them. SubstepCollider in shaders/simulation.glsl
+	Collider Substep(int substep, int numSubsteps) const {
+		Collider c = *this;
+		c.previousCenter = glm::mix(previousCenter, center, (float)substep / numSubsteps);
+		c.center = glm::mix(previousCenter, center, (float)(substep + 1) / numSubsteps);
+		return c;
+	}
+};
+
+// Header of the colliders storage buffer, followed by the colliders
+struct CollidersHeader {
+	uint32_t numColliders;
+	uint32_t pad[3];
+	glm::vec4 sdfFrame; // origin and cell size of the SDF collider, cell size 0 without one
+};
+
+// The SDF collider's gradient and distance as half floats, which every device can filter
+constexpr static VkFormat SDF_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+
+
+// Keep in sync with the GRID defines and FitGrid in shaders/simulation.glsl
+constexpr static int GRID_DIM = 64;
+
+// Grid used when there are no curve points to fit it to
+constexpr static float GRID_HEIGHT = 7.0f;
+const glm::vec3 GRID_ORIGIN = glm::vec3(-3.0f, -2.0f, -5.0f);
+
+// Fitted cell sizes are rounded up to a multiple of this, so the grid only changes scale once the hair
+// has grown or shrunk by a step
+constexpr static float GRID_CELL_STEP = 1.0f / 128.0f;
+
+// Where the grid sits for one step: cell (0, 0, 0) is at origin and every cell is cellSize wide
+struct GridFrame {
+	glm::vec3 origin;
+	float cellSize;
+};
 
-		this->transform = transMat * rotZMat * rotYMat * rotXMat * scaleMat * glm::mat4(1.0);
-		this->inv = glm::inverse(this->transform);
-		this->invTrans = glm::transpose(this->inv);
+// Grid covering the curve points between lo and hi with at least one free cell on each side. The origin is
+// snapped to a multiple of the cell size, so the cells stay put while the hair moves within them
+inline GridFrame FitGrid(glm::vec3 lo, glm::vec3 hi) {
+	if (!(lo.x <= hi.x && lo.y <= hi.y && lo.z <= hi.z)) {
+		return { GRID_ORIGIN, GRID_HEIGHT / GRID_DIM };
 	}
+
+	glm::vec3 size = hi - lo;
+	float extent = std::max(std::max(size.x, size.y), size.z);
+	float cellSize = std::max(std::ceil(extent / (GRID_DIM - 3) / GRID_CELL_STEP), 1.0f) * GRID_CELL_STEP;
+	return { glm::floor(lo / cellSize) * cellSize - cellSize, cellSize };
+}
+
+// The GPU grid only stores the bricks of GRID_BRICK_DIM^3 cells the hair reaches, at most GRID_MAX_BRICKS a step.
+// Memory and per step work follow the volume of the hair rather than GRID_DIM^3
+constexpr static int GRID_BRICK_DIM = 4;
+constexpr static int GRID_BRICKS_PER_AXIS = GRID_DIM / GRID_BRICK_DIM;
+constexpr static int GRID_BRICK_CELLS = GRID_BRICK_DIM * GRID_BRICK_DIM * GRID_BRICK_DIM;
+constexpr static int GRID_MAX_BRICKS = 2048;
+
+// Bounds of every curve point simulated this step, reduced by shaders/gridBounds.comp as order preserving
+// uint encodings of the floats. Cleared to an empty box (lo above hi) before each step
+struct GridBounds {
+	glm::uvec4 lo;
+	glm::uvec4 hi;
 };
 
+// Brick table of the sparse grid. The first three words are the indirect dispatch of gridNormalize and, at the
+// end of the step, gridRelease. gridRelease empties the table entries the step used, so only numBricks and
+// maxBrickPoints have to be cleared before the next one
+struct GridBricks {
+	uint32_t numBricks;      // claimed this step, past GRID_MAX_BRICKS when the pool ran out
+	uint32_t groupCountY;    // = 1
+	uint32_t groupCountZ;    // = 1
+	uint32_t maxBrickPoints; // most points reaching one brick, for GridScale
+	uint32_t bricks[GRID_BRICKS_PER_AXIS * GRID_BRICKS_PER_AXIS * GRID_BRICKS_PER_AXIS]; // slot + 1, 0 if empty
+	uint32_t brickPoints[GRID_BRICKS_PER_AXIS * GRID_BRICKS_PER_AXIS * GRID_BRICKS_PER_AXIS];
+	uint32_t slotBricks[GRID_BRICKS_PER_AXIS * GRID_BRICKS_PER_AXIS * GRID_BRICKS_PER_AXIS]; // brick claimed as each slot, storage or not
+};
+
+// Dense GRID_DIM^3 image gridNormalize writes the average velocity (xyz) and density (w) of the allocated cells
+// into, so gridToParticle gathers with one trilinear texture fetch. gridRelease zeroes those cells again
+constexpr static VkFormat GRID_VELOCITY_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+
+// Fixed point grid sums: velocities are clamped to GRID_MAX_SPEED before they are scattered, and the scale
+// is picked each step so the points reaching the densest brick can't sum past GRID_FIXED_POINT_RANGE
+constexpr static float GRID_MAX_SPEED = 64.0f;
+constexpr static float GRID_FIXED_POINT_RANGE = 1073741824.0f;
+
+inline float GridScale(uint32_t maxBrickPoints) {
+	return GRID_FIXED_POINT_RANGE / ((float)std::max(maxBrickPoints, 1u) * GRID_MAX_SPEED);
+}
+
 
 struct GridCell {
 	glm::ivec3 velocity;
@@ -53,13 +168,17 @@ class Scene {
 private:
     Device* device;
     
+    // Device local, the renderer writes them from GetTime() at the start of each frame's simulation and draws.
+    // One per queue, so neither overwrites what the other may still be reading
     VkBuffer timeBuffer;
     VkDeviceMemory timeBufferMemory;
+    VkBuffer renderTimeBuffer;
+    VkDeviceMemory renderTimeBufferMemory;
     Time time;
-
-    void* mappedData;
-	void* mappedData2;
-	void* mappedData3;
+	float fixedDeltaTime = FIXED_TIME_STEP;
+	int maxSubsteps = MAX_SUBSTEPS;
+	float accumulator = 0.0f;
+	int numSubsteps = 0;
 
     std::vector<Model*> models;
 	std::vector<ModelBufferObject> modelMatrices;
@@ -68,19 +187,47 @@ private:
 
     std::vector<Hair*> hair;
 
+	// CollidersHeader then room for MAX_COLLIDERS. Device local, collidersData is what the renderer writes to it
+	// and is rebuilt whenever a collider changes
 	std::vector<Collider> colliders;
 	VkBuffer collidersBuffer;
 	VkDeviceMemory collidersBufferMemory;
+	std::vector<uint32_t> collidersData;
+	void UpdateCollidersBuffer();
+
+	// Mesh collider next to the ellipsoids, sampled by the simulation through sdfImage. The image is a
+	// placeholder when the SDF is empty
+	Sdf sdf;
+	VkImage sdfImage;
+	VkDeviceMemory sdfImageMemory;
+	VkImageView sdfImageView;
+	VkSampler sdfSampler;
 
+	// Cells of GRID_MAX_BRICKS bricks, brick after brick
 	std::vector<GridCell> grid;
 	VkBuffer gridBuffer;
 	VkDeviceMemory gridBufferMemory;
 
+	// Average velocity per cell (xyz) and density (w), filled on the GPU between the grid transfers. Always in
+	// VK_IMAGE_LAYOUT_GENERAL
+	VkImage gridVelocityImage;
+	VkDeviceMemory gridVelocityImageMemory;
+	VkImageView gridVelocityImageView;
+	VkSampler gridVelocitySampler;
+
+	// GridBounds the grid is fitted to each step
+	VkBuffer gridBoundsBuffer;
+	VkDeviceMemory gridBoundsBufferMemory;
+
+	// GridBricks, where each step allocates the bricks it uses
+	VkBuffer gridBricksBuffer;
+	VkDeviceMemory gridBricksBufferMemory;
+
 	high_resolution_clock::time_point startTime = high_resolution_clock::now();
 
 public:
     Scene() = delete;
-    Scene(Device* device, VkCommandPool commandPool, std::vector<Collider> colliders, std::vector<Model*> models);
+    Scene(Device* device, VkCommandPool commandPool, std::vector<Collider> colliders, std::vector<Model*> models, const Sdf& sdf = Sdf());
     ~Scene();
 
 	size_t dynamicAlignment;
@@ -88,6 +235,7 @@ public:
     const std::vector<Model*>& GetModels() const;
     const std::vector<Hair*>& GetHair() const;
     const std::vector<Collider>& GetColliders() const;
+	const Sdf& GetSdf() const;
 	const std::vector<GridCell>& GetGrid() const;
 	const std::vector<ModelBufferObject>& GetModelMatrices() const;
     
@@ -95,11 +243,36 @@ public:
     void AddHair(Hair* hair);
     void AddCollider(Collider collider);
 
+    const Time& GetTime() const;
     VkBuffer GetTimeBuffer() const;
+    VkBuffer GetRenderTimeBuffer() const;
     VkBuffer GetCollidersBuffer() const;
+	VkDeviceSize GetCollidersBufferSize() const;
+
+	// Header and colliders in use, as they go at the start of GetCollidersBuffer()
+	const void* GetCollidersData() const;
+	VkDeviceSize GetCollidersDataSize() const;
+	VkImage GetSdfImage() const;
+	VkImageView GetSdfImageView() const;
+	VkSampler GetSdfSampler() const;
 	VkBuffer GetGridBuffer() const;
+	VkImage GetGridVelocityImage() const;
+	VkImageView GetGridVelocityImageView() const;
+	VkSampler GetGridVelocitySampler() const;
+	VkBuffer GetGridBoundsBuffer() const;
+	VkBuffer GetGridBricksBuffer() const;
 	VkBuffer GetModelBuffer() const;
 
+    // Must be set before the renderer records its compute command buffers
+    void SetTimeStep(float fixedDeltaTime, int maxSubsteps);
+    float GetFixedDeltaTime() const;
+    int GetMaxSubsteps() const;
+
+    // Advances the accumulator by the wall clock delta and works out how many substeps this frame runs
     void UpdateTime();
+
+    // Runs exactly numSubsteps steps this frame whatever the wall clock says, for reproducible benchmarks
+    void StepTime(int numSubsteps);
+    int GetNumSubsteps() const;
 	void translateSphere(glm::vec3 translation);
 };
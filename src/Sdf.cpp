@@ -0,0 +1,286 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include "Sdf.h"
+#include "ObjLoader.h"
+#include "ThreadPool.h"
+
+namespace {
+	// Bump when the bake changes, so older caches are baked again
+	const uint32_t SDF_CACHE_VERSION = 1;
+	const char SDF_CACHE_MAGIC[4] = { 'S', 'D', 'F', 'C' };
+
+	struct Triangle {
+		glm::vec3 a, b, c;
+		glm::vec3 center; // of the bounding sphere
+		float radius;
+	};
+
+	// Closest point to p on triangle abc, from Ericson's Real-Time Collision Detection
+	glm::vec3 ClosestPointOnTriangle(glm::vec3 p, const Triangle& t) {
+		glm::vec3 ab = t.b - t.a;
+		glm::vec3 ac = t.c - t.a;
+		glm::vec3 ap = p - t.a;
+		float d1 = glm::dot(ab, ap);
+		float d2 = glm::dot(ac, ap);
+		if (d1 <= 0.0f && d2 <= 0.0f) {
+			return t.a;
+		}
+
+		glm::vec3 bp = p - t.b;
+		float d3 = glm::dot(ab, bp);
+		float d4 = glm::dot(ac, bp);
+		if (d3 >= 0.0f && d4 <= d3) {
+			return t.b;
+		}
+
+		float vc = d1 * d4 - d3 * d2;
+		if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+			return t.a + ab * (d1 / (d1 - d3));
+		}
+
+		glm::vec3 cp = p - t.c;
+		float d5 = glm::dot(ab, cp);
+		float d6 = glm::dot(ac, cp);
+		if (d6 >= 0.0f && d5 <= d6) {
+			return t.c;
+		}
+
+		float vb = d5 * d2 - d1 * d6;
+		if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+			return t.a + ac * (d2 / (d2 - d6));
+		}
+
+		float va = d3 * d6 - d5 * d4;
+		if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+			return t.b + (t.c - t.b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+		}
+
+		float denom = 1.0f / (va + vb + vc);
+		return t.a + ab * (vb * denom) + ac * (vc * denom);
+	}
+
+	// x where the line along x through (y, z) crosses the triangle, if it does
+	bool CrossRow(const Triangle& t, float y, float z, float& x) {
+		float e0 = (t.b.y - t.a.y) * (z - t.a.z) - (t.b.z - t.a.z) * (y - t.a.y);
+		float e1 = (t.c.y - t.b.y) * (z - t.b.z) - (t.c.z - t.b.z) * (y - t.b.y);
+		float e2 = (t.a.y - t.c.y) * (z - t.c.z) - (t.a.z - t.c.z) * (y - t.c.y);
+		if (!((e0 > 0.0f && e1 > 0.0f && e2 > 0.0f) || (e0 < 0.0f && e1 < 0.0f && e2 < 0.0f))) {
+			return false;
+		}
+
+		// Each edge function weighs the vertex across from it
+		float sum = e0 + e1 + e2;
+		x = (e1 * t.a.x + e2 * t.b.x + e0 * t.c.x) / sum;
+		return true;
+	}
+
+	// FNV-1a, identifies what a cache was baked from
+	uint64_t Hash(const void* data, size_t size, uint64_t hash = 14695981039346656037ull) {
+		const unsigned char* bytes = static_cast<const unsigned char*>(data);
+		for (size_t i = 0; i < size; ++i) {
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	bool ReadCache(const std::string& cachePath, uint64_t key, Sdf& sdf) {
+		std::ifstream file(cachePath, std::ios::binary);
+		if (!file.is_open()) {
+			return false;
+		}
+
+		char magic[4];
+		uint64_t cachedKey = 0;
+		file.read(magic, sizeof(magic));
+		file.read(reinterpret_cast<char*>(&cachedKey), sizeof(cachedKey));
+		if (!file || memcmp(magic, SDF_CACHE_MAGIC, sizeof(magic)) != 0 || cachedKey != key) {
+			return false;
+		}
+
+		file.read(reinterpret_cast<char*>(&sdf.origin), sizeof(sdf.origin));
+		file.read(reinterpret_cast<char*>(&sdf.cellSize), sizeof(sdf.cellSize));
+		file.read(reinterpret_cast<char*>(&sdf.dims), sizeof(sdf.dims));
+		if (!file || sdf.dims.x <= 0 || sdf.dims.y <= 0 || sdf.dims.z <= 0) {
+			return false;
+		}
+
+		sdf.samples.resize((size_t)sdf.dims.x * sdf.dims.y * sdf.dims.z);
+		file.read(reinterpret_cast<char*>(sdf.samples.data()), sdf.samples.size() * sizeof(glm::vec4));
+		return !!file;
+	}
+
+	void WriteCache(const std::string& cachePath, uint64_t key, const Sdf& sdf) {
+		std::ofstream file(cachePath, std::ios::binary | std::ios::trunc);
+		file.write(SDF_CACHE_MAGIC, sizeof(SDF_CACHE_MAGIC));
+		file.write(reinterpret_cast<const char*>(&key), sizeof(key));
+		file.write(reinterpret_cast<const char*>(&sdf.origin), sizeof(sdf.origin));
+		file.write(reinterpret_cast<const char*>(&sdf.cellSize), sizeof(sdf.cellSize));
+		file.write(reinterpret_cast<const char*>(&sdf.dims), sizeof(sdf.dims));
+		file.write(reinterpret_cast<const char*>(sdf.samples.data()), sdf.samples.size() * sizeof(glm::vec4));
+		if (!file) {
+			std::cerr << "Could not write the SDF cache " << cachePath << std::endl;
+		}
+	}
+}
+
+
+bool Sdf::Empty() const {
+	return samples.empty();
+}
+
+
+glm::vec4 Sdf::Sample(glm::vec3 position) const {
+	glm::vec3 u = glm::clamp((position - origin) / cellSize, glm::vec3(0.0f), glm::vec3(dims - 1));
+	glm::ivec3 i0 = glm::min(glm::ivec3(glm::floor(u)), dims - 2);
+	glm::vec3 f = u - glm::vec3(i0);
+
+	glm::vec4 result(0.0f);
+	for (int c = 0; c < 2; ++c) {
+		for (int b = 0; b < 2; ++b) {
+			for (int a = 0; a < 2; ++a) {
+				float weight = (a ? f.x : 1.0f - f.x) * (b ? f.y : 1.0f - f.y) * (c ? f.z : 1.0f - f.z);
+				size_t index = ((size_t)(i0.z + c) * dims.y + (i0.y + b)) * dims.x + (i0.x + a);
+				result += weight * samples[index];
+			}
+		}
+	}
+	return result;
+}
+
+
+Sdf BakeSdf(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, const glm::mat4& transform, int resolution, ThreadPool& pool) {
+	std::vector<Triangle> triangles(indices.size() / 3);
+	glm::vec3 lo(std::numeric_limits<float>::max());
+	glm::vec3 hi(-std::numeric_limits<float>::max());
+	for (size_t i = 0; i < triangles.size(); ++i) {
+		Triangle& t = triangles[i];
+		t.a = glm::vec3(transform * glm::vec4(vertices[indices[3 * i + 0]].pos, 1.0f));
+		t.b = glm::vec3(transform * glm::vec4(vertices[indices[3 * i + 1]].pos, 1.0f));
+		t.c = glm::vec3(transform * glm::vec4(vertices[indices[3 * i + 2]].pos, 1.0f));
+		t.center = (t.a + t.b + t.c) / 3.0f;
+		t.radius = std::max(std::max(glm::distance(t.center, t.a), glm::distance(t.center, t.b)), glm::distance(t.center, t.c));
+		lo = glm::min(lo, glm::min(glm::min(t.a, t.b), t.c));
+		hi = glm::max(hi, glm::max(glm::max(t.a, t.b), t.c));
+	}
+
+	Sdf sdf;
+	if (triangles.empty()) {
+		return sdf;
+	}
+
+	glm::vec3 size = hi - lo;
+	sdf.cellSize = std::max(std::max(size.x, size.y), size.z) / (resolution - 1);
+	sdf.origin = lo - (float)SDF_PADDING * sdf.cellSize;
+	sdf.dims = glm::ivec3(glm::ceil(size / sdf.cellSize)) + 1 + 2 * SDF_PADDING;
+	sdf.samples.resize((size_t)sdf.dims.x * sdf.dims.y * sdf.dims.z);
+
+	// Distances a row along x at a time. The sign comes from how many times the row crossed the surface before
+	// each sample; rows are nudged off the sample positions so they don't run exactly through mesh edges
+	const int numRows = sdf.dims.y * sdf.dims.z;
+	pool.ParallelFor(numRows, 4, [&](int begin, int end, int /*worker*/) {
+		std::vector<float> crossings;
+		for (int row = begin; row < end; ++row) {
+			const int y = row % sdf.dims.y;
+			const int z = row / sdf.dims.y;
+			const float rowY = sdf.origin.y + y * sdf.cellSize + 1.3e-4f * sdf.cellSize;
+			const float rowZ = sdf.origin.z + z * sdf.cellSize + 0.7e-4f * sdf.cellSize;
+
+			crossings.clear();
+			for (const Triangle& t : triangles) {
+				float x;
+				if (CrossRow(t, rowY, rowZ, x)) {
+					crossings.push_back(x);
+				}
+			}
+			std::sort(crossings.begin(), crossings.end());
+
+			// Starting from the triangle closest to the previous sample bounds the search, so most triangles are
+			// skipped on their bounding sphere alone
+			size_t closest = 0;
+			size_t numCrossed = 0;
+			for (int x = 0; x < sdf.dims.x; ++x) {
+				glm::vec3 p = sdf.origin + glm::vec3(x, y, z) * sdf.cellSize;
+				float best = glm::distance(p, ClosestPointOnTriangle(p, triangles[closest]));
+				for (size_t i = 0; i < triangles.size(); ++i) {
+					const Triangle& t = triangles[i];
+					if (glm::distance(p, t.center) - t.radius >= best) {
+						continue;
+					}
+					float distance = glm::distance(p, ClosestPointOnTriangle(p, t));
+					if (distance < best) {
+						best = distance;
+						closest = i;
+					}
+				}
+
+				while (numCrossed < crossings.size() && crossings[numCrossed] < p.x) {
+					++numCrossed;
+				}
+				sdf.samples[(size_t)row * sdf.dims.x + x].w = numCrossed % 2 == 1 ? -best : best;
+			}
+		}
+	});
+
+	// Gradients by central differences, one sided on the border
+	auto distanceAt = [&](int x, int y, int z) {
+		return sdf.samples[((size_t)z * sdf.dims.y + y) * sdf.dims.x + x].w;
+	};
+	pool.ParallelFor(numRows, 16, [&](int begin, int end, int /*worker*/) {
+		for (int row = begin; row < end; ++row) {
+			const int y = row % sdf.dims.y;
+			const int z = row / sdf.dims.y;
+			for (int x = 0; x < sdf.dims.x; ++x) {
+				glm::ivec3 p(x, y, z);
+				glm::ivec3 below = glm::max(p - 1, glm::ivec3(0));
+				glm::ivec3 above = glm::min(p + 1, sdf.dims - 1);
+				glm::vec3 gradient(
+					(distanceAt(above.x, y, z) - distanceAt(below.x, y, z)) / (float)std::max(above.x - below.x, 1),
+					(distanceAt(x, above.y, z) - distanceAt(x, below.y, z)) / (float)std::max(above.y - below.y, 1),
+					(distanceAt(x, y, above.z) - distanceAt(x, y, below.z)) / (float)std::max(above.z - below.z, 1));
+				float length = glm::length(gradient);
+				glm::vec3 normal = length > 0.0f ? gradient / length : glm::vec3(0.0f, 1.0f, 0.0f);
+
+				glm::vec4& sample = sdf.samples[(size_t)row * sdf.dims.x + x];
+				sample = glm::vec4(normal, sample.w);
+			}
+		}
+	});
+
+	return sdf;
+}
+
+
+Sdf LoadOrBakeSdf(const std::string& meshPath, const glm::mat4& transform, int resolution, const std::string& cachePath) {
+	std::ifstream meshFile(meshPath, std::ios::binary);
+	if (!meshFile.is_open()) {
+		std::cerr << "Could not open " << meshPath << " to bake its SDF" << std::endl;
+		return Sdf();
+	}
+	std::vector<char> meshBytes((std::istreambuf_iterator<char>(meshFile)), std::istreambuf_iterator<char>());
+
+	uint64_t key = Hash(&SDF_CACHE_VERSION, sizeof(SDF_CACHE_VERSION));
+	key = Hash(meshBytes.data(), meshBytes.size(), key);
+	key = Hash(&transform, sizeof(transform), key);
+	key = Hash(&resolution, sizeof(resolution), key);
+
+	Sdf sdf;
+	if (ReadCache(cachePath, key, sdf)) {
+		return sdf;
+	}
+
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	ObjLoader::LoadObj(meshPath, vertices, indices);
+
+	ThreadPool pool;
+	sdf = BakeSdf(vertices, indices, transform, resolution, pool);
+	if (!sdf.Empty()) {
+		WriteCache(cachePath, key, sdf);
+	}
+	return sdf;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+#include "Vertex.h"
+
+class ThreadPool;
+
+// Samples along the longest side of the mesh bounds, and empty samples around them so the border is outside
+constexpr static int SDF_RESOLUTION = 96;
+constexpr static int SDF_PADDING = 3;
+
+// Signed distance to a closed mesh on a regular grid, negative inside. Every sample also holds the normalized
+// gradient, so the simulation gets the distance and the surface normal from one trilinear fetch
+struct Sdf {
+	glm::vec3 origin = glm::vec3(0.0f); // position of sample (0, 0, 0)
+	float cellSize = 0.0f;
+	glm::ivec3 dims = glm::ivec3(0);
+	std::vector<glm::vec4> samples;     // gradient xyz, distance w; x first, then y, then z
+
+	bool Empty() const;
+
+	// Trilinear, clamped to the border samples like the sampler the GPU reads it through
+	glm::vec4 Sample(glm::vec3 position) const;
+};
+
+// Bakes the mesh brought into place by transform, spreading the rows of samples across the pool
+Sdf BakeSdf(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, const glm::mat4& transform, int resolution, ThreadPool& pool);
+
+// Loads the bake cached at cachePath if it was made from the same mesh file, transform and resolution. Otherwise
+// bakes the mesh and writes the cache. Empty if the mesh can't be read
+Sdf LoadOrBakeSdf(const std::string& meshPath, const glm::mat4& transform, int resolution, const std::string& cachePath);
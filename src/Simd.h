@@ -0,0 +1,204 @@
+#pragma once
+
+// Thin wrappers over AVX2 / SSE2 / scalar registers so the CPU simulation kernels can be written once
+// and compiled for whichever instruction set the build enables. Each lane holds one strand.
+
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SIMD_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_SSE2
+#endif
+
+namespace simd {
+
+#if defined(SIMD_AVX2)
+
+constexpr static int Width = 8;
+constexpr static const char* Name = "AVX2";
+
+struct Mask {
+	__m256 v;
+	Mask(__m256 v) : v(v) {}
+	Mask operator&(Mask b) const { return _mm256_and_ps(v, b.v); }
+	Mask operator|(Mask b) const { return _mm256_or_ps(v, b.v); }
+};
+
+struct Int {
+	__m256i v;
+	Int(__m256i v) : v(v) {}
+	Int(int x) : v(_mm256_set1_epi32(x)) {}
+	Mask operator>(Int b) const { return _mm256_castsi256_ps(_mm256_cmpgt_epi32(v, b.v)); }
+};
+
+struct Float {
+	__m256 v;
+	Float(__m256 v) : v(v) {}
+	Float(float x) : v(_mm256_set1_ps(x)) {}
+	static Float Load(const float* p) { return _mm256_loadu_ps(p); }
+	void Store(float* p) const { _mm256_storeu_ps(p, v); }
+	Float operator+(Float b) const { return _mm256_add_ps(v, b.v); }
+	Float operator-(Float b) const { return _mm256_sub_ps(v, b.v); }
+	Float operator*(Float b) const { return _mm256_mul_ps(v, b.v); }
+	Float operator/(Float b) const { return _mm256_div_ps(v, b.v); }
+	Mask operator<(Float b) const { return _mm256_cmp_ps(v, b.v, _CMP_LT_OQ); }
+	Mask operator<=(Float b) const { return _mm256_cmp_ps(v, b.v, _CMP_LE_OQ); }
+	Mask operator>(Float b) const { return _mm256_cmp_ps(v, b.v, _CMP_GT_OQ); }
+	Mask operator>=(Float b) const { return _mm256_cmp_ps(v, b.v, _CMP_GE_OQ); }
+};
+
+inline bool Any(Mask m) { return _mm256_movemask_ps(m.v) != 0; }
+inline Float Select(Mask m, Float a, Float b) { return _mm256_blendv_ps(b.v, a.v, m.v); }
+inline Float Sqrt(Float a) { return _mm256_sqrt_ps(a.v); }
+inline Float Min(Float a, Float b) { return _mm256_min_ps(a.v, b.v); }
+inline Float Max(Float a, Float b) { return _mm256_max_ps(a.v, b.v); }
+inline Float Abs(Float a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+inline Float Floor(Float a) { return _mm256_floor_ps(a.v); }
+inline Int ToInt(Float a) { return _mm256_cvttps_epi32(a.v); }
+inline Float ToFloat(Int a) { return _mm256_cvtepi32_ps(a.v); }
+
+// Loads base[index] for every active lane, zero elsewhere
+inline Int Gather(const int* base, Int index, Mask m) {
+	return _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), base, index.v, _mm256_castps_si256(m.v), 4);
+}
+
+#elif defined(SIMD_SSE2)
+
+constexpr static int Width = 4;
+constexpr static const char* Name = "SSE2";
+
+struct Mask {
+	__m128 v;
+	Mask(__m128 v) : v(v) {}
+	Mask operator&(Mask b) const { return _mm_and_ps(v, b.v); }
+	Mask operator|(Mask b) const { return _mm_or_ps(v, b.v); }
+};
+
+struct Int {
+	__m128i v;
+	Int(__m128i v) : v(v) {}
+	Int(int x) : v(_mm_set1_epi32(x)) {}
+	Mask operator>(Int b) const { return _mm_castsi128_ps(_mm_cmpgt_epi32(v, b.v)); }
+};
+
+struct Float {
+	__m128 v;
+	Float(__m128 v) : v(v) {}
+	Float(float x) : v(_mm_set1_ps(x)) {}
+	static Float Load(const float* p) { return _mm_loadu_ps(p); }
+	void Store(float* p) const { _mm_storeu_ps(p, v); }
+	Float operator+(Float b) const { return _mm_add_ps(v, b.v); }
+	Float operator-(Float b) const { return _mm_sub_ps(v, b.v); }
+	Float operator*(Float b) const { return _mm_mul_ps(v, b.v); }
+	Float operator/(Float b) const { return _mm_div_ps(v, b.v); }
+	Mask operator<(Float b) const { return _mm_cmplt_ps(v, b.v); }
+	Mask operator<=(Float b) const { return _mm_cmple_ps(v, b.v); }
+	Mask operator>(Float b) const { return _mm_cmpgt_ps(v, b.v); }
+	Mask operator>=(Float b) const { return _mm_cmpge_ps(v, b.v); }
+};
+
+inline bool Any(Mask m) { return _mm_movemask_ps(m.v) != 0; }
+inline Float Select(Mask m, Float a, Float b) { return _mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v)); }
+inline Float Sqrt(Float a) { return _mm_sqrt_ps(a.v); }
+inline Float Min(Float a, Float b) { return _mm_min_ps(a.v, b.v); }
+inline Float Max(Float a, Float b) { return _mm_max_ps(a.v, b.v); }
+inline Float Abs(Float a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+inline Int ToInt(Float a) { return _mm_cvttps_epi32(a.v); }
+inline Float ToFloat(Int a) { return _mm_cvtepi32_ps(a.v); }
+
+// SSE2 has no round instruction; truncate and step down where truncation rounded up
+inline Float Floor(Float a) {
+	Float t = ToFloat(ToInt(a));
+	return t - Select(t > a, Float(1.0f), Float(0.0f));
+}
+
+// Loads base[index] for every active lane, zero elsewhere
+inline Int Gather(const int* base, Int index, Mask m) {
+	alignas(16) int indices[4];
+	alignas(16) int values[4];
+	_mm_store_si128((__m128i*)indices, index.v);
+	int active = _mm_movemask_ps(m.v);
+	for (int i = 0; i < 4; ++i) {
+		values[i] = (active & (1 << i)) ? base[indices[i]] : 0;
+	}
+	return _mm_load_si128((const __m128i*)values);
+}
+
+#else
+
+constexpr static int Width = 1;
+constexpr static const char* Name = "scalar";
+
+struct Mask {
+	bool v;
+	Mask(bool v) : v(v) {}
+	Mask operator&(Mask b) const { return v && b.v; }
+	Mask operator|(Mask b) const { return v || b.v; }
+};
+
+struct Int {
+	int v;
+	Int(int x) : v(x) {}
+	Mask operator>(Int b) const { return v > b.v; }
+};
+
+struct Float {
+	float v;
+	Float(float x) : v(x) {}
+	static Float Load(const float* p) { return *p; }
+	void Store(float* p) const { *p = v; }
+	Float operator+(Float b) const { return v + b.v; }
+	Float operator-(Float b) const { return v - b.v; }
+	Float operator*(Float b) const { return v * b.v; }
+	Float operator/(Float b) const { return v / b.v; }
+	Mask operator<(Float b) const { return v < b.v; }
+	Mask operator<=(Float b) const { return v <= b.v; }
+	Mask operator>(Float b) const { return v > b.v; }
+	Mask operator>=(Float b) const { return v >= b.v; }
+};
+
+inline bool Any(Mask m) { return m.v; }
+inline Float Select(Mask m, Float a, Float b) { return m.v ? a : b; }
+inline Float Sqrt(Float a) { return std::sqrt(a.v); }
+inline Float Min(Float a, Float b) { return a.v < b.v ? a : b; }
+inline Float Max(Float a, Float b) { return a.v > b.v ? a : b; }
+inline Float Abs(Float a) { return std::fabs(a.v); }
+inline Float Floor(Float a) { return std::floor(a.v); }
+inline Int ToInt(Float a) { return (int)a.v; }
+inline Float ToFloat(Int a) { return (float)a.v; }
+
+inline Int Gather(const int* base, Int index, Mask m) {
+	return m.v ? base[index.v] : 0;
+}
+
+#endif
+
+inline Float Clamp(Float a, Float lo, Float hi) {
+	return Min(Max(a, lo), hi);
+}
+
+// Smallest and largest of the lanes
+inline float HorizontalMin(Float a) {
+	float lanes[Width];
+	a.Store(lanes);
+	float result = lanes[0];
+	for (int i = 1; i < Width; ++i) {
+		result = std::fmin(result, lanes[i]);
+	}
+	return result;
+}
+
+inline float HorizontalMax(Float a) {
+	float lanes[Width];
+	a.Store(lanes);
+	float result = lanes[0];
+	for (int i = 1; i < Width; ++i) {
+		result = std::fmax(result, lanes[i]);
+	}
+	return result;
+}
+
+}
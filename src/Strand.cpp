@@ -1,9 +1,13 @@
 #define TINYOBJLOADER_IMPLEMENTATION 
 
 #include <vector>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
 #include <iostream>
 #include "Strand.h"
-#include "BufferUtils.h"
 #include "tiny_obj_loader.h"
 #include <iostream>
 #include "ObjLoader.h"
@@ -23,7 +27,7 @@ int generateRandomInt(int min, int max) {
 }
 
 
-int GeneratePointsOnMesh(std::string filename, std::vector<glm::vec3>& points, std::vector<glm::vec3>& pointNormals) {
+int GeneratePointsOnMesh(std::string filename, std::vector<glm::vec3>& points, std::vector<glm::vec3>& pointNormals, int numPoints) {
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
 	std::vector<tinyobj::material_t> materials;
@@ -86,7 +90,7 @@ int GeneratePointsOnMesh(std::string filename, std::vector<glm::vec3>& points, s
 	}
 
 	srand(8);
-	for (int i = 0; i < NUM_STRANDS; i++)
+	for (int i = 0; i < numPoints; i++)
 	{
 		// select triangle at random
 		// TODO: account for differences in triangle area?
@@ -142,67 +146,221 @@ int GeneratePointsOnMesh(std::string filename, std::vector<glm::vec3>& points, s
 ////		//pointNormals.push_back(n);
 ////	}
 	//}
-	return NUM_STRANDS;
+	return numPoints;
 }
 
 
-Hair::Hair(Device* device, VkCommandPool commandPool, std::string objFilename) : Model(device, commandPool, {}, {}, glm::mat4(1.0)) {
-	// Vector of strands
-    std::vector<Strand> strands;
+void PackStrandPositions(const glm::vec4* curvePoints, int numCurvePoints, uint32_t* packed) {
+	glm::vec3 root = glm::vec3(curvePoints[0]);
+	std::memcpy(packed, &root, PACKED_ROOT_WORDS * sizeof(uint32_t));
+
+	// Same rounding and layout as packSnorm2x16: the offsets' components one after the other, each pair of them
+	// a word with the first in the low half. An odd count leaves the last high half zero
+	std::vector<uint16_t> components(2 * (PackedStrandWords(numCurvePoints) - PACKED_ROOT_WORDS), 0);
+	for (int i = 1; i < numCurvePoints; ++i) {
+		glm::vec3 offset = (glm::vec3(curvePoints[i]) - root) / PACKED_POSITION_SCALE;
+		for (int c = 0; c < 3; ++c) {
+			components[3 * (i - 1) + c] = (uint16_t)(int16_t)std::round(glm::clamp(offset[c], -1.0f, 1.0f) * 32767.0f);
+		}
+	}
+	for (size_t w = 0; w < components.size() / 2; ++w) {
+		packed[PACKED_ROOT_WORDS + w] = components[2 * w] | (uint32_t)components[2 * w + 1] << 16;
+	}
+}
+
+
+int GenerateStrands(std::string objFilename, std::vector<Strand>& strands, int numStrands, int numCurvePoints) {
+	if (numCurvePoints < 2) {
+		throw std::runtime_error("Strands need at least 2 curve points");
+	}
 
 	std::vector<glm::vec3> pointsOnMesh;
 	std::vector<glm::vec3> pointNormals;
-	numStrands = GeneratePointsOnMesh(objFilename, pointsOnMesh, pointNormals);
+	numStrands = GeneratePointsOnMesh(objFilename, pointsOnMesh, pointNormals, numStrands);
 
 	for (int i = 0; i < numStrands; i++) {
 		Strand currentStrand = Strand();
+		currentStrand.curvePoints.resize(numCurvePoints);
+		currentStrand.curveVels.resize(numCurvePoints);
 		float length = 2.5f;
 
-		// initialize curve point position, velocity and correction vector data
+		// initialize curve point position and velocity data
 		glm::vec3 currPoint = pointsOnMesh[i];
-		for (int j = 0; j < NUM_CURVE_POINTS; j++) {
+		for (int j = 0; j < numCurvePoints; j++) {
 			currentStrand.curvePoints[j] = glm::vec4(currPoint, 1.0);
 			currentStrand.curveVels[j] = glm::vec4(0.0, 0.0, -1.0, 0.0);
-			currentStrand.correctionVecs[j] = glm::vec4(0.0);
 			glm::vec3 dir = pointNormals[i];
 			dir[2] -= 2.0f;
 			dir[1] += 5.0f;
 			dir[0] += 0.05f;
-			currPoint += (float)(length / (NUM_CURVE_POINTS - 1.0)) * dir;
+			currPoint += (float)(length / (numCurvePoints - 1.0)) * dir;
 		}
 
 		strands.push_back(currentStrand);
 	}
 
-	StrandDrawIndirect indirectDraw;
-	indirectDraw.vertexCount = numStrands;
-	indirectDraw.instanceCount = 1;
-	indirectDraw.firstVertex = 0;
-	indirectDraw.firstInstance = 0;
+	return numStrands;
+}
+
+
+namespace {
+	// Guides searched on either side of a strand along the buffer order for the closest roots. The Morton order
+	// keeps most close roots close, and looking at every guide would be quadratic in the strands
+	constexpr int LOD_NEIGHBOR_SEARCH = 32;
+
+	// Spreads the low 10 bits of v out to every third bit
+	uint32_t SpreadBits(uint32_t v) {
+		v = (v | (v << 16)) & 0x030000FF;
+		v = (v | (v << 8)) & 0x0300F00F;
+		v = (v | (v << 4)) & 0x030C30C3;
+		v = (v | (v << 2)) & 0x09249249;
+		return v;
+	}
+}
+
+
+std::vector<uint32_t> SortStrandsByRoot(std::vector<Strand>& strands) {
+	glm::vec3 lo(std::numeric_limits<float>::max());
+	glm::vec3 hi(-std::numeric_limits<float>::max());
+	for (const Strand& strand : strands) {
+		lo = glm::min(lo, glm::vec3(strand.curvePoints[0]));
+		hi = glm::max(hi, glm::vec3(strand.curvePoints[0]));
+	}
+
+	// 10 bits per axis of the roots' bounding box
+	const glm::vec3 scale = 1023.0f / glm::max(hi - lo, glm::vec3(1e-6f));
+	std::vector<uint32_t> codes(strands.size());
+	for (size_t i = 0; i < strands.size(); ++i) {
+		glm::uvec3 cell = glm::uvec3(glm::clamp((glm::vec3(strands[i].curvePoints[0]) - lo) * scale, 0.0f, 1023.0f));
+		codes[i] = SpreadBits(cell.x) | SpreadBits(cell.y) << 1 | SpreadBits(cell.z) << 2;
+	}
+
+	std::vector<uint32_t> order(strands.size());
+	for (size_t i = 0; i < order.size(); ++i) {
+		order[i] = (uint32_t)i;
+	}
+	std::stable_sort(order.begin(), order.end(), [&codes](uint32_t a, uint32_t b) { return codes[a] < codes[b]; });
+
+	std::vector<Strand> sorted(strands.size());
+	for (size_t i = 0; i < order.size(); ++i) {
+		sorted[i] = std::move(strands[order[i]]);
+	}
+	strands.swap(sorted);
+	return order;
+}
+
+
+void BuildSimulationLods(const std::vector<Strand>& strands, std::vector<uint32_t>& lodStrands, std::array<int, NUM_SIMULATION_LODS>& numLodGuides, std::vector<LodNeighbor>& lodNeighbors) {
+	const int numStrands = static_cast<int>(strands.size());
+	lodStrands.clear();
+	lodNeighbors.assign((size_t)NUM_SIMULATION_LODS * numStrands * SIMULATION_LOD_NEIGHBORS, { 0, 0.0f });
+
+	for (int level = 0; level < NUM_SIMULATION_LODS; ++level) {
+		const int stride = 1 << level;
+		numLodGuides[level] = (numStrands + stride - 1) / stride;
+		for (int i = 0; i < numStrands; i += stride) {
+			lodStrands.push_back(i);
+		}
+		for (int i = 0; i < numStrands; ++i) {
+			if (i % stride != 0) {
+				lodStrands.push_back(i);
+			}
+		}
+
+		for (int i = 0; i < numStrands; ++i) {
+			LodNeighbor* neighbors = &lodNeighbors[((size_t)level * numStrands + i) * SIMULATION_LOD_NEIGHBORS];
+			if (i % stride == 0) {
+				neighbors[0] = { (uint32_t)i, 1.0f };
+				continue;
+			}
+
+			// Keep the closest guides sorted by distance
+			std::array<float, SIMULATION_LOD_NEIGHBORS> distances;
+			distances.fill(std::numeric_limits<float>::max());
+			const glm::vec3 root(strands[i].curvePoints[0]);
+			const int guide = i / stride;
+			const int lastGuide = std::min(guide + LOD_NEIGHBOR_SEARCH, numLodGuides[level] - 1);
+			for (int g = std::max(guide - LOD_NEIGHBOR_SEARCH + 1, 0); g <= lastGuide; ++g) {
+				float distance = glm::distance(root, glm::vec3(strands[g * stride].curvePoints[0]));
+				for (int k = 0; k < SIMULATION_LOD_NEIGHBORS; ++k) {
+					if (distance < distances[k]) {
+						for (int m = SIMULATION_LOD_NEIGHBORS - 1; m > k; --m) {
+							distances[m] = distances[m - 1];
+							neighbors[m] = neighbors[m - 1];
+						}
+						distances[k] = distance;
+						neighbors[k].strand = g * stride;
+						break;
+					}
+				}
+			}
+
+			float totalWeight = 0.0f;
+			for (int k = 0; k < SIMULATION_LOD_NEIGHBORS; ++k) {
+				neighbors[k].weight = distances[k] < std::numeric_limits<float>::max() ? 1.0f / (distances[k] + 1e-4f) : 0.0f;
+				totalWeight += neighbors[k].weight;
+			}
+			for (int k = 0; k < SIMULATION_LOD_NEIGHBORS; ++k) {
+				neighbors[k].weight /= totalWeight;
+			}
+		}
+	}
+}
+
+
+Hair::Hair(Device* device, VkCommandPool commandPool, std::string objFilename, int numCurvePoints, StrandSolver solver, int numStrands, glm::mat4 transform) : Model(device, commandPool, {}, {}, glm::mat4(1.0)), numCurvePoints(numCurvePoints), solver(solver) {
+	// Vector of strands
+    std::vector<Strand> strands;
+	this->numStrands = GenerateStrands(objFilename, strands, numStrands, numCurvePoints);
+	for (Strand& strand : strands) {
+		for (int j = 0; j < numCurvePoints; ++j) {
+			strand.curvePoints[j] = transform * strand.curvePoints[j];
+			strand.curveVels[j] = transform * strand.curveVels[j];
+		}
+	}
+	strandOrder = SortStrandsByRoot(strands);
+	BuildSimulationLods(strands, lodStrands, numLodGuides, lodNeighbors);
+
+	glm::vec3 rootsLo(std::numeric_limits<float>::max());
+	glm::vec3 rootsHi(-std::numeric_limits<float>::max());
+	for (const Strand& strand : strands) {
+		rootsLo = glm::min(rootsLo, glm::vec3(strand.curvePoints[0]));
+		rootsHi = glm::max(rootsHi, glm::vec3(strand.curvePoints[0]));
+	}
+	boundingSphere = glm::vec4(0.5f * (rootsLo + rootsHi), 0.5f * glm::distance(rootsLo, rootsHi) + PACKED_POSITION_SCALE);
+
+	// Split the strands into the positions the renderer reads and the velocities only the simulation needs
+	positions.reserve(this->numStrands * numCurvePoints);
+	velocities.reserve(this->numStrands * numCurvePoints);
+	for (int i = 0; i < this->numStrands; ++i) {
+		positions.insert(positions.end(), strands[i].curvePoints.begin(), strands[i].curvePoints.end());
+		velocities.insert(velocities.end(), strands[i].curveVels.begin(), strands[i].curveVels.end());
+	}
+}
+
 
-	ModelBufferObject modelMatrix;
-	modelMatrix.modelMatrix = glm::mat4(1.0);
-	modelMatrix.invTransModelMatrix = glm::mat4(1.0);
+const std::vector<glm::vec4>& Hair::GetPositions() const {
+	return positions;
+}
 
-	// Create buffers
-	BufferUtils::CreateBufferFromData(device, commandPool, strands.data(), numStrands * sizeof(Strand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, strandsBuffer, strandsBufferMemory);
-	BufferUtils::CreateBufferFromData(device, commandPool, &indirectDraw, sizeof(StrandDrawIndirect), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, numStrandsBuffer, numStrandsBufferMemory);
-	BufferUtils::CreateBufferFromData(device, commandPool, &modelMatrix, sizeof(ModelBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, modelBuffer, modelBufferMemory);
+
+const std::vector<glm::vec4>& Hair::GetVelocities() const {
+	return velocities;
 }
 
 
-VkBuffer Hair::GetStrandsBuffer() const {
-    return strandsBuffer;
+const std::vector<uint32_t>& Hair::GetLodStrands() const {
+	return lodStrands;
 }
 
 
-VkBuffer Hair::GetNumStrandsBuffer() const {
-	return numStrandsBuffer;
+const std::vector<LodNeighbor>& Hair::GetLodNeighbors() const {
+	return lodNeighbors;
 }
 
 
-VkBuffer Hair::GetModelBuffer() const {
-	return modelBuffer;
+int Hair::GetNumSimulatedPoints() const {
+	return numStrands * (numCurvePoints - 1);
 }
 
 
@@ -211,13 +369,31 @@ int Hair::GetNumStrands() const {
 }
 
 
-Hair::~Hair() {
-    vkDestroyBuffer(device->GetVkDevice(), strandsBuffer, nullptr);
-    vkFreeMemory(device->GetVkDevice(), strandsBufferMemory, nullptr);
+int Hair::GetNumCurvePoints() const {
+	return numCurvePoints;
+}
+
+
+StrandSolver Hair::GetSolver() const {
+	return solver;
+}
+
+
+int Hair::GetNumLodGuides(int level) const {
+	return numLodGuides[level];
+}
+
+
+int Hair::GetFirstLodStrand(int level) const {
+	return level * numStrands;
+}
+
+
+glm::vec4 Hair::GetBoundingSphere() const {
+	return boundingSphere;
+}
 
-	vkDestroyBuffer(device->GetVkDevice(), numStrandsBuffer, nullptr);
-	vkFreeMemory(device->GetVkDevice(), numStrandsBufferMemory, nullptr);
 
-	vkDestroyBuffer(device->GetVkDevice(), modelBuffer, nullptr);
-	vkFreeMemory(device->GetVkDevice(), modelBufferMemory, nullptr);
+const std::vector<uint32_t>& Hair::GetStrandOrder() const {
+	return strandOrder;
 }
@@ -2,54 +2,76 @@
 #include <vulkan/vulkan.h>
 #include <glm/glm.hpp>
 #include <array>
+#include <cstdint>
+#include <vector>
 #include "Model.h"
 #include "iostream"
 
 constexpr static unsigned int NUM_STRANDS = 900;
-constexpr static unsigned int NUM_CURVE_POINTS = 10;
 
+// Curve points per strand when a hair doesn't ask for a count. The shaders take the actual count
+// as a specialization constant, so any count >= 2 works without rebuilding them.
+constexpr static int DEFAULT_NUM_CURVE_POINTS = 10;
+
+// Render from root relative 16-bit positions written by shaders/packPositions.comp after each step,
+// instead of the fp32 simulation positions.
+constexpr static bool PACK_STRAND_POSITIONS = true;
+
+// Copies of what the hair passes draw from. The simulation writes the oldest slot while the frames in flight
+// read the newer ones, so a step runs on the compute queue alongside the draws of the steps before it
+constexpr static int NUM_DRAW_SLOTS = MAX_FRAMES_IN_FLIGHT + 1;
+
+// Largest distance of a curve point from its root, packed offsets are stored divided by it. The shaders get it
+// as specialization constant 5 (shaders/packedPositions.glsl)
+constexpr static float PACKED_POSITION_SCALE = 2.5f;
+
+// How the integrate stage maps strands to GPU threads, picked per hair
+enum class StrandSolver {
+	// shaders/integrate.comp: one invocation walks a whole strand point by point. Best for many short strands
+	ThreadPerStrand,
+
+	// shaders/integrateStrandGroup.comp: one invocation per curve point, the strand's points in one workgroup.
+	// Keeps the GPU busy with few long strands, see STRAND_GROUP_FTL_PASSES
+	WorkgroupPerStrand,
+};
+
+// Follow the leader passes of StrandSolver::WorkgroupPerStrand. 0 walks each chain in order, matching
+// ThreadPerStrand; n > 0 solves it as n parallel prefix sums, fewer steps for long strands but stiffer
+// hair until n reaches the number of segments
+constexpr static int STRAND_GROUP_FTL_PASSES = 0;
+
+// Radix sort of the simulated curve points by the Morton code of their grid cell, which the renderer can run
+// before the grid transfers. Each pass sorts POINT_SORT_RADIX_BITS of the 18 bit code, in tiles of
+// POINT_SORT_TILE points. Same as the shaders
+constexpr static int POINT_SORT_TILE = 256;
+constexpr static int POINT_SORT_RADIX_BITS = 6;
+constexpr static int POINT_SORT_RADIX = 1 << POINT_SORT_RADIX_BITS;
+constexpr static int POINT_SORT_PASSES = 3;
+
+// Full state of one strand on the host, as generated and as read back for validation.
+// On the GPU the positions and velocities live in separate buffers of numCurvePoints vec4s per strand,
+// so the render passes only fetch positions.
 struct Strand {
-	// Attributes
-	glm::vec4 curvePoints[NUM_CURVE_POINTS];
-	glm::vec4 curveVels[NUM_CURVE_POINTS];
-	glm::vec4 correctionVecs[NUM_CURVE_POINTS];
-
-    static VkVertexInputBindingDescription getBindingDescription() {
-        VkVertexInputBindingDescription bindingDescription = {};
-        bindingDescription.binding = 0;
-        bindingDescription.stride = sizeof(Strand);
-        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-
-        return bindingDescription;
-    }
-
-	static std::array<VkVertexInputAttributeDescription, 3 * NUM_CURVE_POINTS> getAttributeDescriptions() {
-		std::array<VkVertexInputAttributeDescription, 3 * NUM_CURVE_POINTS> attributeDescriptions = {};
-		for (int i = 0; i < NUM_CURVE_POINTS; ++i) {
-			attributeDescriptions[i].binding = 0;
-			attributeDescriptions[i].location = i;
-			attributeDescriptions[i].format = VK_FORMAT_R32G32B32A32_SFLOAT;
-			attributeDescriptions[i].offset = offsetof(Strand, curvePoints[i]);
-		}
-		for (int i = NUM_CURVE_POINTS; i < 2 * NUM_CURVE_POINTS; ++i) {
-			attributeDescriptions[i].binding = 0;
-			attributeDescriptions[i].location = i;
-			attributeDescriptions[i].format = VK_FORMAT_R32G32B32A32_SFLOAT;
-			attributeDescriptions[i].offset = offsetof(Strand, curveVels[i - NUM_CURVE_POINTS]);
-		}
-
-		for (int i = 2 * NUM_CURVE_POINTS; i < 3 * NUM_CURVE_POINTS; ++i) {
-			attributeDescriptions[i].binding = 0;
-			attributeDescriptions[i].location = i;
-			attributeDescriptions[i].format = VK_FORMAT_R32G32B32A32_SFLOAT;
-			attributeDescriptions[i].offset = offsetof(Strand, correctionVecs[i - 2 * NUM_CURVE_POINTS]);
-		}
-
-        return attributeDescriptions;
-    }
+	std::vector<glm::vec4> curvePoints;
+	std::vector<glm::vec4> curveVels;
 };
 
 
+// Words of the fp32 xyz root at the start of a packed strand. Same as PACKED_ROOT_WORDS in the shaders
+constexpr static int PACKED_ROOT_WORDS = 3;
+
+// 32-bit words per strand in the packed positions buffer: the root, then a snorm16 xyz offset from it for every
+// other curve point, 6 bytes each back to back. Matches PACKED_STRAND_WORDS in the shaders. 17 words for the
+// default 10 curve points, 68 bytes against 160 as fp32 vec4s
+inline uint32_t PackedStrandWords(int numCurvePoints) {
+	return PACKED_ROOT_WORDS + (3 * (numCurvePoints - 1) + 1) / 2;
+}
+
+// Host side version of shaders/packPositions.comp, used for the initial buffer contents.
+// Writes PackedStrandWords(numCurvePoints) words to packed
+void PackStrandPositions(const glm::vec4* curvePoints, int numCurvePoints, uint32_t* packed);
+
+
 struct StrandDrawIndirect {
 	uint32_t vertexCount;
 	uint32_t instanceCount;
@@ -57,24 +79,160 @@ struct StrandDrawIndirect {
 	uint32_t firstInstance;
 };
 
+// Views the strands are culled against every frame, the camera for the hair pass and the light for the shadow
+// and opacity map passes
+enum CullView {
+	CULL_VIEW_CAMERA,
+	CULL_VIEW_LIGHT,
+	NUM_CULL_VIEWS
+};
 
-class Hair : public Model {
-private:
-    VkBuffer strandsBuffer;
-	VkBuffer numStrandsBuffer;
-	VkBuffer modelBuffer;
+// Start of the strand pool's culled strands buffer, followed by a list of pool strand indices per view, as many
+// as the pool holds. The draw of view v starts at the first entry of its list. Same layout as in
+// shaders/hairStrands.glsl
+struct CulledStrands {
+	StrandDrawIndirect draws[NUM_CULL_VIEWS];
+};
+
+// Entry of the strand pool's group table, one per hair. The pool holds the strands of every hair back to back in
+// world space, so the hair passes and the cull pass cover all of them at once without knowing the groups
+struct HairGroup {
+	uint32_t firstStrand;
+	uint32_t numStrands;
+};
 
-    VkDeviceMemory strandsBufferMemory;
-    VkDeviceMemory numStrandsBufferMemory;
-	VkDeviceMemory modelBufferMemory;
 
+// Simulation LOD levels. Level l simulates every 2^l-th strand in buffer order as a guide, which spreads the
+// guides over the scalp since the strands are sorted by root, and interpolates the others from nearby guides
+constexpr static int NUM_SIMULATION_LODS = 4;
+
+// Guides each interpolated strand follows. Same as LOD_NEIGHBORS in the shaders
+constexpr static int SIMULATION_LOD_NEIGHBORS = 3;
+
+// Projected pixels of a hair's bounds per simulated guide the renderer aims for when it picks a level
+constexpr static float SIMULATION_LOD_PIXELS_PER_GUIDE = 16.0f;
+
+// A guide comes to rest once the mean squared speed of its points stays under REST_SPEED^2 for REST_STEPS steps
+// in a row, and is no longer stepped until a collider reaching it moves. Same as REST_SPEED in the shaders
+constexpr static float REST_SPEED = 0.05f;
+constexpr static uint32_t REST_STEPS = 30;
+
+// Indirect dispatches in SimulationLod, for the stages that run over a level's guides or its interpolated strands
+enum SimulationLodDispatch {
+	LOD_DISPATCH_COMPACT_AWAKE,
+	LOD_DISPATCH_INTERPOLATE,
+	NUM_LOD_DISPATCHES,
+};
+
+// Indirect dispatches in AwakeStrands, for the stages that only run over the guides that aren't resting
+enum AwakeDispatch {
+	AWAKE_DISPATCH_INTEGRATE,
+	AWAKE_DISPATCH_INTEGRATE_STRAND_GROUP,
+	AWAKE_DISPATCH_GRID_ALLOCATE,
+	AWAKE_DISPATCH_SORT_KEYS,
+	AWAKE_DISPATCH_SORT_TILES,
+	AWAKE_DISPATCH_PARTICLE_TO_GRID,
+	AWAKE_DISPATCH_GRID_TO_PARTICLE,
+	NUM_AWAKE_DISPATCHES,
+};
+
+// Level one hair group simulates at, an entry of the table after SimulationLod. Matches SimulationLodGroup in
+// shaders/simulation.glsl
+struct SimulationLodGroup {
+	uint32_t firstStrand;         // the group's strands in the pool, as in HairGroup
+	uint32_t numStrands;
+	uint32_t level;
+	uint32_t solver;              // StrandSolver
+	uint32_t firstLodStrand;      // the level's guides in the pool's lod strands, its interpolated strands after them
+	uint32_t numGuides;
+	uint32_t firstGuide;          // guides of the groups before this one
+	uint32_t firstInterpolated;   // interpolated strands of the groups before this one
+};
+
+// Levels the hair groups of the strand pool simulate at, written by the renderer every frame and followed by
+// numGroups SimulationLodGroups. Matches SimulationLod in shaders/simulation.glsl
+struct SimulationLod {
+	uint32_t numGuides;           // of every group
+	uint32_t numInterpolated;
+	uint32_t numGroups;
+	uint32_t restSteps;           // REST_STEPS, 0 keeps every guide awake
+	glm::uvec4 dispatches[NUM_LOD_DISPATCHES]; // workgroup counts, w unused
+	glm::uvec4 awakeWorkgroups[NUM_AWAKE_DISPATCHES]; // invocations per awake guide (x) and per workgroup (y)
+};
+
+// Start of the strand pool's awake strands buffer, rebuilt by shaders/compactAwake.comp every step and followed by
+// the pool strand indices of the awake guides of every group. Matches AwakeStrands in shaders/simulation.glsl
+struct AwakeStrands {
+	uint32_t numAwakeStrands;
+	uint32_t padding[3];
+	glm::uvec4 dispatches[NUM_AWAKE_DISPATCHES]; // workgroup counts, w unused
+};
+
+// A guide an interpolated strand follows, weights of a strand sum to one
+struct LodNeighbor {
+	uint32_t strand;
+	float weight;
+};
+
+
+// Seeds strands on random points of the mesh, pointing roughly up and back from the surface.
+// Doesn't touch the GPU, so the CPU simulator can use it on its own.
+int GenerateStrands(std::string objFilename, std::vector<Strand>& strands, int numStrands = NUM_STRANDS, int numCurvePoints = DEFAULT_NUM_CURVE_POINTS);
+
+// Reorders strands along a Morton curve over their roots, so strands next to each other in memory also grow
+// next to each other and neighbouring GPU threads touch nearby grid cells and pixels. Returns the index each
+// strand had before, in the new order
+std::vector<uint32_t> SortStrandsByRoot(std::vector<Strand>& strands);
+
+// Simulation LODs of strands sorted by SortStrandsByRoot. Fills lodStrands with, level by level, the guides of
+// the level followed by the strands it interpolates, each in buffer order, and numLodGuides with the guides per
+// level. lodNeighbors gets SIMULATION_LOD_NEIGHBORS guides per level and strand, level major, the closest roots
+// weighted by inverse distance. A guide just lists itself
+void BuildSimulationLods(const std::vector<Strand>& strands, std::vector<uint32_t>& lodStrands, std::array<int, NUM_SIMULATION_LODS>& numLodGuides, std::vector<LodNeighbor>& lodNeighbors);
+
+
+class Hair : public Model {
+private:
 	int numStrands;
+	int numCurvePoints;
+	StrandSolver solver;
+	std::vector<uint32_t> strandOrder;
+	std::array<int, NUM_SIMULATION_LODS> numLodGuides;
+	glm::vec4 boundingSphere;
+
+	// What the renderer starts the hair's group of its strand pool from, the simulation state lives in the pool
+	std::vector<glm::vec4> positions;
+	std::vector<glm::vec4> velocities;
+	std::vector<uint32_t> lodStrands;
+	std::vector<LodNeighbor> lodNeighbors;
 
 public:
-    Hair(Device* device, VkCommandPool commandPool, std::string objFilename);
-    VkBuffer GetStrandsBuffer() const;
-    VkBuffer GetNumStrandsBuffer() const;
-	VkBuffer GetModelBuffer() const;
+    // transform places the strands grown on the obj in the scene. It is baked into the generated curve points, so
+    // the hair simulates against the scene's colliders and draws in world space like every other group
+    Hair(Device* device, VkCommandPool commandPool, std::string objFilename, int numCurvePoints = DEFAULT_NUM_CURVE_POINTS, StrandSolver solver = StrandSolver::ThreadPerStrand, int numStrands = NUM_STRANDS, glm::mat4 transform = glm::mat4(1.0));
+
+	// Generated curve points of every strand, numCurvePoints each in the order GetStrandOrder gives
+	const std::vector<glm::vec4>& GetPositions() const;
+	const std::vector<glm::vec4>& GetVelocities() const;
+
+	// What BuildSimulationLods made for the hair, in hair strand indices
+	const std::vector<uint32_t>& GetLodStrands() const;
+	const std::vector<LodNeighbor>& GetLodNeighbors() const;
+
+	// Curve points the simulation moves at full detail, every point but the roots. Coarser simulation LODs move fewer
+	int GetNumSimulatedPoints() const;
 	int GetNumStrands() const;
-    ~Hair();
+	int GetNumCurvePoints() const;
+	StrandSolver GetSolver() const;
+	int GetNumLodGuides(int level) const;
+
+	// First guide of the level in the lod strands
+	int GetFirstLodStrand(int level) const;
+
+	// Sphere (xyz center, w radius) around the roots and as far as a strand reaches from them
+	glm::vec4 GetBoundingSphere() const;
+
+	// Index GenerateStrands gave each strand, in the order the buffers hold them. Per strand data made
+	// alongside the strands has to be permuted the same way
+	const std::vector<uint32_t>& GetStrandOrder() const;
 };
@@ -68,9 +68,11 @@ SwapChain::SwapChain(Device* device, VkSurfaceKHR vkSurface, unsigned int numBuf
     VkSemaphoreCreateInfo semaphoreInfo = {};
     semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-    if (vkCreateSemaphore(device->GetVkDevice(), &semaphoreInfo, nullptr, &imageAvailableSemaphore) != VK_SUCCESS ||
-        vkCreateSemaphore(device->GetVkDevice(), &semaphoreInfo, nullptr, &renderFinishedSemaphore) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to create semaphores");
+    for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        if (vkCreateSemaphore(device->GetVkDevice(), &semaphoreInfo, nullptr, &imageAvailableSemaphores[frame]) != VK_SUCCESS ||
+            vkCreateSemaphore(device->GetVkDevice(), &semaphoreInfo, nullptr, &renderFinishedSemaphores[frame]) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create semaphores");
+        }
     }
 }
 
@@ -179,16 +181,22 @@ VkImage SwapChain::GetVkImage(uint32_t index) const {
     return vkSwapChainImages[index];
 }
 
+uint32_t SwapChain::GetFrameIndex() const {
+    return frameIndex;
+}
+
 VkSemaphore SwapChain::GetImageAvailableVkSemaphore() const {
-    return imageAvailableSemaphore;
+    return imageAvailableSemaphores[frameIndex];
 
 }
 
 VkSemaphore SwapChain::GetRenderFinishedVkSemaphore() const {
-    return renderFinishedSemaphore;
+    return renderFinishedSemaphores[frameIndex];
 }
 
 void SwapChain::Recreate() {
+    // Earlier frames may still be drawing to or presenting the old images
+    vkDeviceWaitIdle(device->GetVkDevice());
     Destroy();
     Create();
 }
@@ -198,7 +206,7 @@ bool SwapChain::Acquire() {
         // the validation layer implementation expects the application to explicitly synchronize with the GPU
         vkQueueWaitIdle(device->GetQueue(QueueFlags::Present));
     }
-    VkResult result = vkAcquireNextImageKHR(device->GetVkDevice(), vkSwapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+    VkResult result = vkAcquireNextImageKHR(device->GetVkDevice(), vkSwapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphores[frameIndex], VK_NULL_HANDLE, &imageIndex);
     if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
         throw std::runtime_error("Failed to acquire swap chain image");
     }
@@ -212,7 +220,7 @@ bool SwapChain::Acquire() {
 }
 
 bool SwapChain::Present() {
-    VkSemaphore signalSemaphores[] = { renderFinishedSemaphore };
+    VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[frameIndex] };
 
     // Submit result back to swap chain for presentation
     VkPresentInfoKHR presentInfo = {};
@@ -227,6 +235,7 @@ bool SwapChain::Present() {
     presentInfo.pResults = nullptr;
 
     VkResult result = vkQueuePresentKHR(device->GetQueue(QueueFlags::Present), &presentInfo);
+    frameIndex = (frameIndex + 1) % MAX_FRAMES_IN_FLIGHT;
 
     if (result != VK_SUCCESS) {
         throw std::runtime_error("Failed to present swap chain image");
@@ -241,7 +250,9 @@ bool SwapChain::Present() {
 }
 
 SwapChain::~SwapChain() {
-    vkDestroySemaphore(device->GetVkDevice(), imageAvailableSemaphore, nullptr);
-    vkDestroySemaphore(device->GetVkDevice(), renderFinishedSemaphore, nullptr);
+    for (int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        vkDestroySemaphore(device->GetVkDevice(), imageAvailableSemaphores[frame], nullptr);
+        vkDestroySemaphore(device->GetVkDevice(), renderFinishedSemaphores[frame], nullptr);
+    }
     Destroy();
 }
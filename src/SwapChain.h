@@ -1,8 +1,13 @@
 #pragma once
 
+#include <array>
 #include <vector>
 #include "Device.h"
 
+// Frames the CPU can be recording while the GPU still works on earlier ones. Each has its own semaphores here
+// and its own fences and uniform uploads in the renderer
+constexpr static int MAX_FRAMES_IN_FLIGHT = 2;
+
 class Device;
 class SwapChain {
     friend class Device;
@@ -14,6 +19,9 @@ public:
     uint32_t GetIndex() const;
     uint32_t GetCount() const;
     VkImage GetVkImage(uint32_t index) const;
+
+    // Frame in flight the next Acquire and Present are for, and its semaphores. Present moves on to the next one
+    uint32_t GetFrameIndex() const;
     VkSemaphore GetImageAvailableVkSemaphore() const;
     VkSemaphore GetRenderFinishedVkSemaphore() const;
     
@@ -35,7 +43,8 @@ private:
     VkFormat vkSwapChainImageFormat;
     VkExtent2D vkSwapChainExtent;
     uint32_t imageIndex = 0;
+    uint32_t frameIndex = 0;
 
-    VkSemaphore imageAvailableSemaphore;
-    VkSemaphore renderFinishedSemaphore;
+    std::array<VkSemaphore, MAX_FRAMES_IN_FLIGHT> imageAvailableSemaphores;
+    std::array<VkSemaphore, MAX_FRAMES_IN_FLIGHT> renderFinishedSemaphores;
 };
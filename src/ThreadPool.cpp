@@ -0,0 +1,130 @@
+#include <algorithm>
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int numThreads) : pendingTasks(0) {
+	if (numThreads <= 0) {
+		numThreads = std::max((int)std::thread::hardware_concurrency(), 1);
+	}
+
+	for (int i = 0; i < numThreads; ++i) {
+		queues.emplace_back(new WorkQueue());
+	}
+
+	// Worker 0 is whoever calls ParallelFor
+	for (int i = 1; i < numThreads; ++i) {
+		threads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+	}
+}
+
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wakeCondition.notify_all();
+
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+}
+
+
+int ThreadPool::GetNumThreads() const {
+	return (int)queues.size();
+}
+
+
+void ThreadPool::ParallelFor(int count, int grainSize, const RangeFunction& function) {
+	if (count <= 0) {
+		return;
+	}
+
+	grainSize = std::max(grainSize, 1);
+	const int numTasks = (count + grainSize - 1) / grainSize;
+	if (threads.empty() || numTasks == 1) {
+		function(0, count, 0);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		this->function = &function;
+		pendingTasks = numTasks;
+
+		// Give each worker a contiguous run of chunks so neighbouring strands stay on one core
+		const int numQueues = GetNumThreads();
+		for (int task = 0; task < numTasks; ++task) {
+			Task t = { task * grainSize, std::min((task + 1) * grainSize, count) };
+			WorkQueue& queue = *queues[(long long)task * numQueues / numTasks];
+			std::lock_guard<std::mutex> queueLock(queue.mutex);
+			queue.tasks.push_back(t);
+		}
+		++generation;
+	}
+	wakeCondition.notify_all();
+
+	while (RunTask(0)) {}
+
+	std::unique_lock<std::mutex> lock(mutex);
+	doneCondition.wait(lock, [this] { return pendingTasks == 0; });
+	this->function = nullptr;
+}
+
+
+void ThreadPool::WorkerLoop(int worker) {
+	unsigned int seenGeneration = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeCondition.wait(lock, [&] { return quit || generation != seenGeneration; });
+			if (quit) {
+				return;
+			}
+			seenGeneration = generation;
+		}
+
+		while (RunTask(worker)) {}
+	}
+}
+
+
+bool ThreadPool::RunTask(int worker) {
+	Task task;
+	bool found = false;
+
+	// Own work first, newest chunk first
+	{
+		WorkQueue& queue = *queues[worker];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.tasks.empty()) {
+			task = queue.tasks.back();
+			queue.tasks.pop_back();
+			found = true;
+		}
+	}
+
+	// Otherwise steal the oldest chunk of another worker
+	const int numQueues = GetNumThreads();
+	for (int i = 1; i < numQueues && !found; ++i) {
+		WorkQueue& queue = *queues[(worker + i) % numQueues];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (!queue.tasks.empty()) {
+			task = queue.tasks.front();
+			queue.tasks.pop_front();
+			found = true;
+		}
+	}
+
+	if (!found) {
+		return false;
+	}
+
+	(*function)(task.begin, task.end, worker);
+
+	if (--pendingTasks == 0) {
+		std::lock_guard<std::mutex> lock(mutex);
+		doneCondition.notify_all();
+	}
+	return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fork-join pool with one task deque per worker. ParallelFor splits a range into chunks,
+// hands each worker a contiguous run of them, and idle workers steal from the other end
+// of their neighbours' deques. The calling thread takes part as worker 0.
+class ThreadPool {
+public:
+	// Called on [begin, end) by the given worker, 0 <= worker < GetNumThreads()
+	typedef std::function<void(int begin, int end, int worker)> RangeFunction;
+
+private:
+	struct Task {
+		int begin;
+		int end;
+	};
+
+	struct WorkQueue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	std::vector<std::thread> threads;
+	std::vector<std::unique_ptr<WorkQueue>> queues;
+
+	std::mutex mutex;
+	std::condition_variable wakeCondition;
+	std::condition_variable doneCondition;
+	const RangeFunction* function = nullptr;
+	unsigned int generation = 0;
+	std::atomic<int> pendingTasks;
+	bool quit = false;
+
+	void WorkerLoop(int worker);
+	bool RunTask(int worker);
+
+public:
+	// 0 threads uses every hardware thread
+	explicit ThreadPool(int numThreads = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	int GetNumThreads() const;
+
+	// Runs function over [0, count) in chunks of grainSize and returns once every chunk is done
+	void ParallelFor(int count, int grainSize, const RangeFunction& function);
+};
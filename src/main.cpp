@@ -1,5 +1,6 @@
 #include <vulkan/vulkan.h>
 #include <sstream>
+#include <algorithm>
 #include "Instance.h"
 #include "Window.h"
 #include "Renderer.h"
@@ -8,6 +9,8 @@
 #include "Image.h"
 #include <iostream>
 #include "ObjLoader.h"
+#include "CpuSimulator.h"
+#include "Simd.h"
 
 
 Device* device;
@@ -23,6 +26,15 @@ bool DDown = false;
 bool QDown = false;
 bool EDown = false;
 
+// Step the CPU reference simulator next to the GPU and report how far they drift apart (toggle with V)
+bool validateSimulation = false;
+
+// Print the GPU time of each simulation stage once per second (toggle with T)
+bool printComputeTimings = false;
+
+// Simulate only the guide strands of each hair's LOD, off while validating
+bool simulationLod = true;
+
 
 namespace {
     void resizeCallback(GLFWwindow* window, int width, int height) {
@@ -87,6 +99,20 @@ namespace {
 				EDown = false;
 			}
 		}
+		else if (key == GLFW_KEY_V) {
+			if (action == GLFW_PRESS) {
+				validateSimulation = !validateSimulation;
+
+				// The CPU simulator steps every strand, so the GPU has to as well
+				renderer->SetSimulationLodEnabled(simulationLod && !validateSimulation);
+				std::cout << "Simulation validation " << (validateSimulation ? "on" : "off") << std::endl;
+			}
+		}
+		else if (key == GLFW_KEY_T) {
+			if (action == GLFW_PRESS) {
+				printComputeTimings = !printComputeTimings;
+			}
+		}
 	}
 
     void mouseDownCallback(GLFWwindow* window, int button, int action, int mods) {
@@ -157,7 +183,221 @@ void moveSphere(VkCommandPool commandPool) {
 }
 
 
-int main() {
+// The mannequin as an SDF collider, baked on first use and cached next to the model. Empty if it can't be read
+Sdf loadMannequinSdf() {
+	return LoadOrBakeSdf("models/mannequin.obj", glm::scale(glm::vec3(0.98f)), SDF_RESOLUTION, "models/mannequin.sdf");
+}
+
+
+// Hand placed ellipsoids around a mannequin moved by offset
+std::vector<Collider> mannequinColliders(glm::vec3 offset) {
+	// trans, rot, scale
+	//Collider faceCollider = Collider(offset + glm::vec3(0.0, 2.511, 0.915), glm::vec3(0, 0.0, 0.0), glm::vec3(0.561, 0.749, 0.615));
+	Collider headCollider = Collider(offset + glm::vec3(0.0, 2.64, 0.08), glm::vec3(-38.270, 0.0, 0.0), glm::vec3(0.817, 1.158, 1.01));
+	Collider neckCollider = Collider(offset + glm::vec3(0.0, 1.35, -0.288), glm::vec3(18.301, 0.0, 0.0), glm::vec3(0.457, 1.0, 0.538));
+	Collider bustCollider = Collider(offset + glm::vec3(0.0, -0.380, -0.116), glm::vec3(-17.260, 0.0, 0.0), glm::vec3(1.078, 1.683, 0.974));
+	Collider shoulderRCollider = Collider(offset + glm::vec3(-0.698, 0.087, -0.36), glm::vec3(-20.254, 13.144, 34.5), glm::vec3(0.721, 1.0, 0.724));
+	Collider shoulderLCollider = Collider(offset + glm::vec3(0.698, 0.087, -0.36), glm::vec3(-20.254, 13.144, -34.5), glm::vec3(0.721, 1.0, 0.724));
+
+	return { /*faceCollider,*/ headCollider, neckCollider, bustCollider, shoulderRCollider, shoulderLCollider };
+}
+
+
+// The movable sphere, plus the ellipsoids around the mannequin when there is no SDF of it
+std::vector<Collider> createColliders(bool mannequinEllipsoids) {
+	// trans, rot, scale
+	std::vector<Collider> colliders = { Collider(glm::vec3(2.0, 0.0, 1.0), glm::vec3(0.0), glm::vec3(1.0)) };
+	if (mannequinEllipsoids) {
+		std::vector<Collider> ellipsoids = mannequinColliders(glm::vec3(0.0));
+		colliders.insert(colliders.end(), ellipsoids.begin(), ellipsoids.end());
+	}
+	return colliders;
+}
+
+
+// Runs the CPU simulator without creating a window or touching Vulkan
+int runCpuBenchmark(int numStrands, int numSteps, int numThreads, int numCurvePoints, StrandSolver solver, bool mannequinEllipsoids) {
+	std::vector<Strand> strands;
+	GenerateStrands("models/mannequin_segment.obj", strands, numStrands, numCurvePoints);
+	SortStrandsByRoot(strands);
+	Sdf sdf = mannequinEllipsoids ? Sdf() : loadMannequinSdf();
+	CpuSimulator simulator(strands, createColliders(sdf.Empty()));
+	simulator.SetSdf(&sdf);
+	simulator.SetSolver(solver);
+	ThreadPool pool(numThreads);
+	numThreads = pool.GetNumThreads();
+
+	const float deltaTime = FIXED_TIME_STEP;
+	high_resolution_clock::time_point start = high_resolution_clock::now();
+	for (int i = 0; i < numSteps; ++i) {
+		if (numThreads > 1) {
+			simulator.Step(deltaTime, pool);
+		}
+		else {
+			simulator.Step(deltaTime);
+		}
+	}
+	duration<double> elapsed = high_resolution_clock::now() - start;
+
+	double msPerStep = 1000.0 * elapsed.count() / numSteps;
+	double strandsPerSecond = numStrands * numSteps / elapsed.count();
+	std::cout << "CPU simulator (" << simd::Name << ", " << numThreads << " threads): " << numStrands << " strands of " << numCurvePoints << " points, " << numSteps << " steps" << std::endl;
+	std::cout << "  " << msPerStep << " ms/step, " << strandsPerSecond << " strands/s, " << (strandsPerSecond / numThreads) << " strands/s/core" << std::endl;
+	return 0;
+}
+
+
+// Replays one GPU step on the CPU from the same starting state and compares the results. The hair groups share
+// the grid on the GPU, so the CPU steps the strands of every group together, groups one after the other
+SimulationDivergence validateSimulationStep(Scene* scene) {
+	vkDeviceWaitIdle(device->GetVkDevice());
+
+	const std::vector<Hair*>& hair = scene->GetHair();
+	std::vector<Strand> before;
+	for (size_t i = 0; i < hair.size(); ++i) {
+		std::vector<Strand> strands;
+		renderer->ReadStrands(i, strands);
+		before.insert(before.end(), strands.begin(), strands.end());
+		if (hair[i]->GetSolver() != hair[0]->GetSolver()) {
+			throw std::runtime_error("Failed to validate simulation, every hair has to use the same solver");
+		}
+	}
+
+	scene->UpdateTime();
+	renderer->Frame();
+	vkDeviceWaitIdle(device->GetVkDevice());
+
+	if (hair.empty()) {
+		return SimulationDivergence();
+	}
+
+	CpuSimulator simulator(before, scene->GetColliders());
+	simulator.SetSdf(&scene->GetSdf());
+	simulator.SetSolver(hair[0]->GetSolver());
+	for (int substep = 0; substep < scene->GetNumSubsteps(); ++substep) {
+		std::vector<Collider> colliders;
+		for (const Collider& collider : scene->GetColliders()) {
+			colliders.push_back(collider.Substep(substep, scene->GetNumSubsteps()));
+		}
+		simulator.SetColliders(colliders);
+		simulator.Step(scene->GetTime().deltaTime);
+	}
+
+	std::vector<Strand> cpuStrands;
+	std::vector<Strand> gpuStrands;
+	simulator.GetStrands(cpuStrands);
+	for (size_t i = 0; i < hair.size(); ++i) {
+		std::vector<Strand> strands;
+		renderer->ReadStrands(i, strands);
+		gpuStrands.insert(gpuStrands.end(), strands.begin(), strands.end());
+	}
+	return CpuSimulator::Compare(cpuStrands, gpuStrands);
+}
+
+
+void printDivergence(const SimulationDivergence& divergence) {
+	std::cout << "CPU vs GPU: max position error " << divergence.maxPositionError
+		<< " (strand " << divergence.worstStrand << ", point " << divergence.worstCurvePoint << ")"
+		<< ", mean " << divergence.meanPositionError
+		<< ", max velocity error " << divergence.maxVelocityError
+		<< ", mean " << divergence.meanVelocityError << std::endl;
+	std::cout << "  max position error per curve point:";
+	for (float error : divergence.maxPositionErrorPerPoint) {
+		std::cout << " " << error;
+	}
+	std::cout << std::endl;
+}
+
+
+void printComputeStageTimes(const std::array<float, NUM_COMPUTE_STAGES>& times, bool floatGridAtomics, bool sortedGridPoints) {
+	std::cout << "Simulation stages (ms, " << (floatGridAtomics ? "float" : "fixed point") << " grid sums, "
+		<< (sortedGridPoints ? "sorted" : "unsorted") << " points):";
+	for (int stage = 0; stage < NUM_COMPUTE_STAGES; ++stage) {
+		std::cout << " " << COMPUTE_STAGE_NAMES[stage] << " " << times[stage];
+	}
+	std::cout << std::endl;
+}
+
+
+// Times the simulation stages on fixed point grid sums and then on float atomics, where the device has them.
+// Each path runs the same number of frames of exactly one step with every strand simulated, and prints the mean
+// time of each stage after some frames to settle in
+void runGpuBenchmark(Scene* scene, int numFrames) {
+	const int warmUpFrames = 60;
+	renderer->SetSimulationLodEnabled(false);
+
+	for (bool floatGridAtomics : { false, true }) {
+		renderer->SetFloatGridAtomics(floatGridAtomics);
+		if (floatGridAtomics && !renderer->UsesFloatGridAtomics()) {
+			std::cout << "No float atomics on this device, only the fixed point grid sums were timed" << std::endl;
+			break;
+		}
+
+		std::array<float, NUM_COMPUTE_STAGES> meanTimes = {};
+		for (int frame = -warmUpFrames; frame < numFrames && !ShouldQuit(); ++frame) {
+			glfwPollEvents();
+			scene->StepTime(1);
+			renderer->Frame();
+			if (frame >= 0) {
+				for (int stage = 0; stage < NUM_COMPUTE_STAGES; ++stage) {
+					meanTimes[stage] += renderer->GetComputeStageTimes()[stage] / numFrames;
+				}
+			}
+		}
+		printComputeStageTimes(meanTimes, renderer->UsesFloatGridAtomics(), renderer->SortsGridPoints());
+	}
+}
+
+
+int main(int argc, char** argv) {
+	// --ellipsoids collides with the hand placed ellipsoids instead of the baked mannequin SDF, here and in the
+	// CPU benchmark
+	bool mannequinEllipsoids = std::find(argv + 1, argv + argc, std::string("--ellipsoids")) != argv + argc;
+
+	// --cpu-benchmark [numStrands] [numSteps] [numThreads] [numCurvePoints] [strand|group] runs the CPU simulator
+	// headless and exits, 0 threads uses every core
+	if (argc > 1 && std::string(argv[1]) == "--cpu-benchmark") {
+		int numStrands = argc > 2 ? std::atoi(argv[2]) : NUM_STRANDS;
+		int numSteps = argc > 3 ? std::atoi(argv[3]) : 1000;
+		int numThreads = argc > 4 ? std::atoi(argv[4]) : 0;
+		int numCurvePoints = argc > 5 ? std::atoi(argv[5]) : DEFAULT_NUM_CURVE_POINTS;
+		StrandSolver solver = argc > 6 && std::string(argv[6]) == "group" ? StrandSolver::WorkgroupPerStrand : StrandSolver::ThreadPerStrand;
+		return runCpuBenchmark(std::max(numStrands, 1), std::max(numSteps, 1), numThreads, std::max(numCurvePoints, 2), solver, mannequinEllipsoids);
+	}
+
+	// --curve-points N simulates and renders the hair with N points per strand, e.g. 4 for short fur.
+	// --solver group integrates it with a workgroup per strand instead of a thread per strand.
+	// --grid-atomics fixed keeps the fixed point grid sums on devices with float atomics, to compare the two.
+	// --sort-points sorts the curve points by grid cell before the grid transfers, compare the stage timings with T.
+	// --sim-budget N simulates at most about N guide strands per step over all hair, --sim-lod off every strand
+	// --gpu-benchmark N prints the stage timings of N frames with fixed point and with float grid sums, then exits
+	int numCurvePoints = DEFAULT_NUM_CURVE_POINTS;
+	int gpuBenchmarkFrames = 0;
+	int simulationStrandBudget = 0;
+	StrandSolver solver = StrandSolver::ThreadPerStrand;
+	bool allowFloatGridAtomics = true;
+	bool sortGridPoints = std::find(argv + 1, argv + argc, std::string("--sort-points")) != argv + argc;
+	for (int i = 1; i + 1 < argc; ++i) {
+		if (std::string(argv[i]) == "--curve-points") {
+			numCurvePoints = std::max(std::atoi(argv[i + 1]), 2);
+		}
+		else if (std::string(argv[i]) == "--solver" && std::string(argv[i + 1]) == "group") {
+			solver = StrandSolver::WorkgroupPerStrand;
+		}
+		else if (std::string(argv[i]) == "--grid-atomics" && std::string(argv[i + 1]) == "fixed") {
+			allowFloatGridAtomics = false;
+		}
+		else if (std::string(argv[i]) == "--sim-budget") {
+			simulationStrandBudget = std::max(std::atoi(argv[i + 1]), 0);
+		}
+		else if (std::string(argv[i]) == "--sim-lod" && std::string(argv[i + 1]) == "off") {
+			simulationLod = false;
+		}
+		else if (std::string(argv[i]) == "--gpu-benchmark") {
+			gpuBenchmarkFrames = std::max(std::atoi(argv[i + 1]), 1);
+		}
+	}
+
     static constexpr char* applicationName = "Realtime Vulkan Hair";
 	const float windowWidth = 1080.f;
 	const float windowHeight = 720.f;
@@ -181,7 +421,26 @@ int main() {
     deviceFeatures.fillModeNonSolid = VK_TRUE;
     deviceFeatures.samplerAnisotropy = VK_TRUE;
 
-    device = instance->CreateDevice(QueueFlagBit::GraphicsBit | QueueFlagBit::TransferBit | QueueFlagBit::ComputeBit | QueueFlagBit::PresentBit, deviceFeatures);
+    // Float atomics for the grid sums where the device has them, the renderer falls back to fixed point otherwise
+    const void* extensionFeatures = nullptr;
+#ifdef VK_EXT_shader_atomic_float
+    VkPhysicalDeviceShaderAtomicFloatFeaturesEXT atomicFloatFeatures = {};
+    atomicFloatFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_ATOMIC_FLOAT_FEATURES_EXT;
+    if (allowFloatGridAtomics &&
+        instance->IsDeviceExtensionSupported(VK_EXT_SHADER_ATOMIC_FLOAT_EXTENSION_NAME) &&
+        instance->GetDeviceFeatures(&atomicFloatFeatures) &&
+        atomicFloatFeatures.shaderBufferFloat32AtomicAdd
+    ) {
+        // Only enable what particleToGridFloat.comp uses
+        atomicFloatFeatures = {};
+        atomicFloatFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SHADER_ATOMIC_FLOAT_FEATURES_EXT;
+        atomicFloatFeatures.shaderBufferFloat32AtomicAdd = VK_TRUE;
+        instance->EnableDeviceExtension(VK_EXT_SHADER_ATOMIC_FLOAT_EXTENSION_NAME);
+        extensionFeatures = &atomicFloatFeatures;
+    }
+#endif
+
+    device = instance->CreateDevice(QueueFlagBit::GraphicsBit | QueueFlagBit::TransferBit | QueueFlagBit::ComputeBit | QueueFlagBit::PresentBit, deviceFeatures, extensionFeatures);
 
     swapChain = device->CreateSwapChain(surface, 5);
 
@@ -223,36 +482,45 @@ int main() {
 	Model* mannequin = new Model(device, transferCommandPool, vertices, indices, glm::scale(glm::vec3(0.98f)));
 	mannequin->SetTexture(mannequinDiffuseImage);
 
-	Hair* hair = new Hair(device, transferCommandPool, "models/mannequin_segment.obj");
+	Hair* hair = new Hair(device, transferCommandPool, "models/mannequin_segment.obj", numCurvePoints, solver);
 
-	// trans, rot, scale
-	Collider sphereCollider = Collider(glm::vec3(2.0, 0.0, 1.0), glm::vec3(0.0), glm::vec3(1.0));
-	//Collider faceCollider = Collider(glm::vec3(0.0, 2.511, 0.915), glm::vec3(0, 0.0, 0.0), glm::vec3(0.561, 0.749, 0.615));
-	Collider headCollider = Collider(glm::vec3(0.0, 2.64, 0.08), glm::vec3(-38.270, 0.0, 0.0), glm::vec3(0.817, 1.158, 1.01));
-	Collider neckCollider = Collider(glm::vec3(0.0, 1.35, -0.288), glm::vec3(18.301, 0.0, 0.0), glm::vec3(0.457, 1.0, 0.538));
-	Collider bustCollider = Collider(glm::vec3(0.0, -0.380, -0.116), glm::vec3(-17.260, 0.0, 0.0), glm::vec3(1.078, 1.683, 0.974));
-	Collider shoulderRCollider = Collider(glm::vec3(-0.698, 0.087, -0.36), glm::vec3(-20.254, 13.144, 34.5), glm::vec3(0.721, 1.0, 0.724));
-	Collider shoulderLCollider = Collider(glm::vec3(0.698, 0.087, -0.36), glm::vec3(-20.254, 13.144, -34.5), glm::vec3(0.721, 1.0, 0.724));
+	// A second, sparser head of hair on another mannequin to the side, its own group of the strand pool. Its strands
+	// are generated in world space and collide with ellipsoids around it, the SDF only covers the first mannequin
+	const glm::vec3 secondMannequinOffset(-3.0f, 0.0f, 0.0f);
+	ObjLoader::LoadObj("models/mannequin.obj", vertices, indices);
+	Model* secondMannequin = new Model(device, transferCommandPool, vertices, indices, glm::translate(secondMannequinOffset) * glm::scale(glm::vec3(0.98f)));
+	secondMannequin->SetTexture(mannequinDiffuseImage);
+	Hair* secondHair = new Hair(device, transferCommandPool, "models/mannequin_segment2.obj", numCurvePoints, solver, NUM_STRANDS / 3, glm::translate(secondMannequinOffset));
 
-	std::vector<Collider> colliders = { sphereCollider, /*faceCollider,*/ headCollider, neckCollider, bustCollider, shoulderRCollider, shoulderLCollider };
+	Sdf mannequinSdf = mannequinEllipsoids ? Sdf() : loadMannequinSdf();
+	std::vector<Collider> colliders = createColliders(mannequinSdf.Empty());
+	std::vector<Collider> secondMannequinColliders = mannequinColliders(secondMannequinOffset);
+	colliders.insert(colliders.end(), secondMannequinColliders.begin(), secondMannequinColliders.end());
 
-	std::vector<Model*> models = { collisionSphere, mannequin };
+	std::vector<Model*> models = { collisionSphere, mannequin, secondMannequin };
 
-    Scene* scene = new Scene(device, transferCommandPool, colliders, models);
+    Scene* scene = new Scene(device, transferCommandPool, colliders, models, mannequinSdf);
     scene->AddHair(hair);
+    scene->AddHair(secondHair);
 
-	vkDestroyCommandPool(device->GetVkDevice(), transferCommandPool, nullptr);
-
-    renderer = new Renderer(device, swapChain, scene, camera, shadowCamera);
+    renderer = new Renderer(device, swapChain, scene, camera, shadowCamera, sortGridPoints);
+    renderer->SetSimulationLodEnabled(simulationLod);
+    renderer->SetSimulationStrandBudget(simulationStrandBudget);
 
     glfwSetWindowSizeCallback(GetGLFWWindow(), resizeCallback);
     glfwSetMouseButtonCallback(GetGLFWWindow(), mouseDownCallback);
     glfwSetCursorPosCallback(GetGLFWWindow(), mouseMoveCallback);
 	glfwSetKeyCallback(GetGLFWWindow(), keyPressCallback);
 
+	if (gpuBenchmarkFrames > 0) {
+		runGpuBenchmark(scene, gpuBenchmarkFrames);
+		glfwSetWindowShouldClose(GetGLFWWindow(), GLFW_TRUE);
+	}
+
 	double fps = 0;
 	double timebase = 0;
 	int frame = 0;
+	SimulationDivergence divergence;
 
     while (!ShouldQuit()) {
         glfwPollEvents();
@@ -270,6 +538,13 @@ int main() {
 			fps = frame / (time - timebase);
 			timebase = time;
 			frame = 0;
+
+			if (validateSimulation) {
+				printDivergence(divergence);
+			}
+			if (printComputeTimings) {
+				printComputeStageTimes(renderer->GetComputeStageTimes(), renderer->UsesFloatGridAtomics(), renderer->SortsGridPoints());
+			}
 		}
 
 		std::ostringstream ss;
@@ -279,20 +554,29 @@ int main() {
 		ss << " fps] ";
 		glfwSetWindowTitle(GetGLFWWindow(), ss.str().c_str());
 
-		scene->UpdateTime();
-		renderer->Frame();
+		if (validateSimulation) {
+			divergence = validateSimulationStep(scene);
+		}
+		else {
+			scene->UpdateTime();
+			renderer->Frame();
+		}
 		moveSphere(transferCommandPool);
     }
 
     vkDeviceWaitIdle(device->GetVkDevice());
 
+	vkDestroyCommandPool(device->GetVkDevice(), transferCommandPool, nullptr);
+
 	vkDestroyImage(device->GetVkDevice(), mannequinDiffuseImage, nullptr);
 	vkFreeMemory(device->GetVkDevice(), mannequinDiffuseImageMemory, nullptr);
 
     delete scene;
 	delete collisionSphere;
 	delete mannequin;
+	delete secondMannequin;
     delete hair;
+    delete secondHair;
     delete camera;
     delete shadowCamera;
     delete renderer;
@@ -1,19 +1,19 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
-#define NUM_CURVE_POINTS 10
+#extension GL_GOOGLE_include_directive : enable
 
-layout(set = 1, binding = 0) uniform ModelBufferObject {
-    mat4 model;
-};
+#include "hairStrands.glsl"
 
-layout(location = 0) in vec4 in_curvePoints[NUM_CURVE_POINTS];
+// The strands cullStrands.comp left visible to the view drawing, whose draw starts at the first of them
+layout(set = 1, binding = 5) readonly buffer CulledStrands {
+	uvec4 draws[NUM_CULL_VIEWS];
+	uint strands[];
+} culled;
 
-layout(location = 0) out vec4 out_curvePoints[NUM_CURVE_POINTS];
+// One vertex per visible strand and no vertex attributes, the strand's curve points are read in hair.tese
+layout(location = 0) out uint out_strand;
 
 void main() {
-	for (int i = 0; i < NUM_CURVE_POINTS; i++) {
-		out_curvePoints[i] = model * in_curvePoints[i];
-	}
-
-	gl_Position = in_curvePoints[0];
+	out_strand = culled.strands[gl_VertexIndex];
+	gl_Position = CurvePoint(out_strand, 0);
 }
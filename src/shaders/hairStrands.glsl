@@ -0,0 +1,64 @@
+// Strand data shared by the hair passes: hair.vert draws one vertex per visible strand without attributes,
+// and hair.tese fetches the curve points of that strand from the render positions buffers. cullStrands.comp
+// reads the strands the same way to decide which are visible. Strands are indices into the renderer's strand
+// pool, which holds the strands of every hair group back to back in world space.
+
+// Set when the positions buffers hold packed strands, see packedPositions.glsl
+layout(constant_id = 0) const bool PACKED_POSITIONS = false;
+
+// Curve points per strand, set by the renderer from the hair it draws
+layout(constant_id = 1) const int NUM_CURVE_POINTS = 10;
+
+#include "packedPositions.glsl"
+
+layout(set = 1, binding = 2) uniform Time {
+    float deltaTime;
+    float totalTime;
+    float alpha;
+};
+
+// Render positions after the last substep and before it, read as raw words so either format fits
+layout(set = 1, binding = 3) readonly buffer CurvePoints {
+	uint curvePointWords[];
+};
+
+layout(set = 1, binding = 4) readonly buffer PrevCurvePoints {
+	uint prevCurvePointWords[];
+};
+
+// Views of the culled strands buffer (CullView in Strand.h). Its draws come first, one per view as
+// vertexCount, instanceCount, firstVertex, firstInstance, then the views' lists of visible pool strands. View
+// v's list and draw start at v times the strands in the pool
+#define CULL_VIEW_CAMERA 0
+#define CULL_VIEW_LIGHT 1
+#define NUM_CULL_VIEWS 2
+
+
+uint CurvePointWord(uint index, bool previous) {
+	return previous ? prevCurvePointWords[index] : curvePointWords[index];
+}
+
+
+// Curve point i of a strand in simulation space, root first
+vec4 LoadCurvePoint(uint strand, int i, bool previous) {
+	if (PACKED_POSITIONS) {
+		uint first = strand * uint(PACKED_STRAND_WORDS);
+		vec3 root = uintBitsToFloat(uvec3(CurvePointWord(first, previous), CurvePointWord(first + 1, previous), CurvePointWord(first + 2, previous)));
+		if (i == 0) {
+			return vec4(root, 1.0);
+		}
+
+		uint component = 3u * uint(i - 1);
+		uint word = first + PACKED_ROOT_WORDS + component / 2u;
+		return vec4(root + UnpackOffset(component, CurvePointWord(word, previous), CurvePointWord(word + 1, previous)), 1.0);
+	}
+
+	uint word = 4 * (strand * uint(NUM_CURVE_POINTS) + uint(i));
+	return vec4(uintBitsToFloat(uvec3(CurvePointWord(word, previous), CurvePointWord(word + 1, previous), CurvePointWord(word + 2, previous))), 1.0);
+}
+
+
+// Curve point i of a strand in world space, interpolated between the last two fixed simulation steps
+vec4 CurvePoint(uint strand, int i) {
+	return mix(LoadCurvePoint(strand, i, true), LoadCurvePoint(strand, i, false), alpha);
+}
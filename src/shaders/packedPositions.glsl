@@ -0,0 +1,18 @@
+// Packed strand positions (PackedStrandWords and PackStrandPositions in Strand.h), written by packPositions.comp
+// and read by the hair passes: the fp32 xyz root in 3 words, then a snorm16 xyz offset from it per curve point,
+// 6 bytes each back to back. Included after NUM_CURVE_POINTS is declared.
+
+// Largest distance of a curve point from its root, offsets are stored divided by it. The renderer sets it from
+// PACKED_POSITION_SCALE in Strand.h
+layout(constant_id = 5) const float PACKED_POSITION_SCALE = 1.0;
+
+#define PACKED_ROOT_WORDS 3
+#define PACKED_STRAND_WORDS (PACKED_ROOT_WORDS + (3 * (NUM_CURVE_POINTS - 1) + 1) / 2)
+
+// Offset from the root of the curve point whose components start at component, given the word holding that
+// component and the word after it. The components start in the low or the high half and end in the next word
+vec3 UnpackOffset(uint component, uint word, uint nextWord) {
+	vec2 a = unpackSnorm2x16(word);
+	vec2 b = unpackSnorm2x16(nextWord);
+	return PACKED_POSITION_SCALE * (component % 2u == 0u ? vec3(a, b.x) : vec3(a.y, b));
+}
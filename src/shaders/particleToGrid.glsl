@@ -0,0 +1,91 @@
+// Body of particleToGrid.comp and particleToGridFloat.comp, which include it after defining
+//   float ScatterScale(): fixed point scale the contributions are summed with in shared memory
+//   void FlushToCell(int index, ivec4 sums, float scale): adds merged velocity (xyz) and density (w) sums to a cell
+// for their kind of grid sums.
+//
+// One invocation per simulated curve point (every point but the root), in sorted order with SORT_GRID_POINTS.
+// Scatters its velocity and density into the 8 surrounding grid cells, all allocated by gridAllocate.comp.
+// Contributions are first merged per cell in a workgroup hash table, so cells shared by the workgroup's points
+// take one global atomic per sum instead of one per point. A contribution that finds no room in the table goes
+// to the grid directly.
+
+#define SCATTER_TABLE_SIZE 512
+#define SCATTER_TABLE_BITS 9
+#define SCATTER_MAX_PROBES 16
+#define SCATTER_EMPTY 0xFFFFFFFFu
+
+shared uint tableCells[SCATTER_TABLE_SIZE];
+shared int tableSumX[SCATTER_TABLE_SIZE];
+shared int tableSumY[SCATTER_TABLE_SIZE];
+shared int tableSumZ[SCATTER_TABLE_SIZE];
+shared int tableDensity[SCATTER_TABLE_SIZE];
+
+void AddToTable(int index, ivec4 sums, float scale) {
+	uint slot = (uint(index) * 2654435761u) >> (32 - SCATTER_TABLE_BITS);
+	for (int probe = 0; probe < SCATTER_MAX_PROBES; ++probe) {
+		uint cell = atomicCompSwap(tableCells[slot], SCATTER_EMPTY, uint(index));
+		if (cell == SCATTER_EMPTY || cell == uint(index)) {
+			atomicAdd(tableSumX[slot], sums.x);
+			atomicAdd(tableSumY[slot], sums.y);
+			atomicAdd(tableSumZ[slot], sums.z);
+			atomicAdd(tableDensity[slot], sums.w);
+			return;
+		}
+		slot = (slot + 1u) % SCATTER_TABLE_SIZE;
+	}
+	FlushToCell(index, sums, scale);
+}
+
+void main() {
+	uint threadIdx = gl_GlobalInvocationID.x;
+
+	for (uint slot = gl_LocalInvocationID.x; slot < SCATTER_TABLE_SIZE; slot += gl_WorkGroupSize.x) {
+		tableCells[slot] = SCATTER_EMPTY;
+		tableSumX[slot] = 0;
+		tableSumY[slot] = 0;
+		tableSumZ[slot] = 0;
+		tableDensity[slot] = 0;
+	}
+	barrier();
+
+	// Invocations past the last point still reach both barriers
+	float scale = ScatterScale();
+	if (threadIdx < NumSimulatedPoints()) {
+		uint pointIdx = GridTransferPoint(threadIdx);
+
+		// Get grid index position of curve point. The velocity is clamped to what the fixed point sums have room for
+		vec3 p = GridPosition(positions[pointIdx].xyz);
+		vec3 velocity = clamp(velocities[pointIdx].xyz, -GRID_MAX_SPEED, GRID_MAX_SPEED);
+
+		// Transfer Velocity and density to grid
+		int xmin = max(int(floor(p.x)), 0);
+		int xmax = min(int(floor(p.x)) + 1, GRID_DIM - 1);
+		int ymin = max(int(floor(p.y)), 0);
+		int ymax = min(int(floor(p.y)) + 1, GRID_DIM - 1);
+		int zmin = max(int(floor(p.z)), 0);
+		int zmax = min(int(floor(p.z)) + 1, GRID_DIM - 1);
+
+		for (int a = xmin; a <= xmax; ++a) {
+			for (int b = ymin; b <= ymax; ++b) {
+				for (int c = zmin; c <= zmax; ++c) {
+					int index = GridCellSlot(a, b, c);
+					if (index < 0) {
+						continue;
+					}
+					float totalWeight = GridWeight(p, a, b, c);
+					vec3 weightedVelocity = totalWeight * velocity;
+					AddToTable(index, ivec4(int(scale * weightedVelocity.x), int(scale * weightedVelocity.y), int(scale * weightedVelocity.z), int(scale * totalWeight)), scale);
+				}
+			}
+		}
+	}
+	barrier();
+
+	// Flush the merged sums
+	for (uint slot = gl_LocalInvocationID.x; slot < SCATTER_TABLE_SIZE; slot += gl_WorkGroupSize.x) {
+		uint cell = tableCells[slot];
+		if (cell != SCATTER_EMPTY) {
+			FlushToCell(int(cell), ivec4(tableSumX[slot], tableSumY[slot], tableSumZ[slot], tableDensity[slot]), scale);
+		}
+	}
+}
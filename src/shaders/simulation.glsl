@@ -0,0 +1,478 @@
+// Declarations shared by the simulation stages: integrate.comp (or integrateStrandGroup.comp), gridBounds.comp,
+// gridAllocate.comp, the point sort (sortKeys.comp, sortHistogram.comp, sortScan.comp, sortScatter.comp),
+// particleToGrid.comp, gridNormalize.comp, gridToParticle.comp, gridRelease.comp, interpolateStrands.comp and
+// packPositions.comp.
+// Every stage uses the same pipeline layout.
+
+#define EPSILON 0.00001
+#define DAMPING 0.998
+#define GRID_DIM 64
+#define GRID_HEIGHT 7
+#define GRID_CELL_STEP (1.0 / 128.0)
+#define GRID_BRICK_DIM 4
+#define GRID_BRICKS_PER_AXIS (GRID_DIM / GRID_BRICK_DIM)
+#define GRID_BRICK_CELLS (GRID_BRICK_DIM * GRID_BRICK_DIM * GRID_BRICK_DIM)
+#define GRID_MAX_BRICKS 2048
+#define GRID_BRICK_FULL 0xFFFFFFFFu
+#define GRID_MAX_SPEED 64.0
+#define GRID_FIXED_POINT_RANGE 1073741824.0
+#define STRAND_LENGTH 2.5
+#define POINT_SORT_TILE 256
+#define POINT_SORT_RADIX_BITS 6
+#define POINT_SORT_RADIX 64
+#define LOD_NEIGHBORS 3
+#define NUM_LOD_DISPATCHES 2
+#define NUM_AWAKE_DISPATCHES 7
+#define SOLVER_WORKGROUP_PER_STRAND 1u
+#define REST_SPEED 0.05
+
+// Workgroup size is a specialization constant so each stage can be tuned from the renderer
+layout(local_size_x_id = 0, local_size_y = 1, local_size_z = 1) in;
+
+// Curve points per strand, set by the renderer from the hair it simulates
+layout(constant_id = 1) const int NUM_CURVE_POINTS = 10;
+
+#include "packedPositions.glsl"
+
+// Grid sums are float atomics (particleToGridFloat.comp) rather than fixed point, when the device has them
+layout(constant_id = 3) const bool FLOAT_GRID_ATOMICS = false;
+
+// The grid transfers visit the curve points in the order the point sort left in sortedPoints
+layout(constant_id = 4) const bool SORT_GRID_POINTS = false;
+
+layout(set = 0, binding = 0) uniform CameraBufferObject {
+    mat4 view;
+    mat4 proj;
+} camera;
+
+layout(set = 1, binding = 0) uniform Time {
+    float deltaTime; // fixed step
+    float totalTime;
+    float alpha;
+};
+
+// Ellipsoid, see Collider in Scene.h
+struct Collider {
+	vec4 center; // w is the bounding radius
+	vec4 axes[3];
+	vec4 radii;
+	vec4 previousCenter;
+};
+
+// Up to MAX_COLLIDERS (Scene.h), one bit each in the uvec2 candidate masks from StrandColliders
+layout(std430, set = 2, binding = 0) readonly buffer Colliders {
+	uint numColliders;
+	vec4 sdfFrame; // origin and cell size of sdfTexture, cell size 0 if there is no SDF collider
+	Collider colliders[];
+};
+
+// Pushed by Renderer::RecordComputeCommandBuffer: which radix pass of the point sort is running, and which part
+// of the colliders' motion since the last frame the current substep covers
+layout(push_constant) uniform SimulationPushConstants {
+	uint sortPass;
+	float sweepBegin;
+	float sweepEnd;
+};
+
+// Sdf in Sdf.h: normalized gradient (xyz) and signed distance (w) to the mannequin, negative inside
+layout(set = 2, binding = 1) uniform sampler3D sdfTexture;
+
+struct GridCell {
+	ivec3 velocity;
+	int density;
+};
+
+// The grid is sparse: only the GRID_BRICK_DIM^3 bricks of cells some curve point reaches get storage, allocated
+// each step by gridAllocate. Cells are addressed through GridCellSlot.
+
+// Velocity and density sums of the allocated bricks, scattered into by particleToGrid. Fixed point scaled by
+// GridScale, or the float bits with FLOAT_GRID_ATOMICS. gridNormalize zeroes them again as it reads them, so
+// they are never cleared
+layout(set = 3, binding = 0) buffer Grid {
+	GridCell cells[GRID_MAX_BRICKS * GRID_BRICK_CELLS];
+} grid;
+
+// Density weighted average velocity of each cell (xyz) and its density (w), written by gridNormalize into the
+// allocated bricks and zeroed again by gridRelease, so the cells no point reached stay zero.
+// gridToParticle samples the same image through gridVelocityTexture, trilinear and zero outside the grid
+layout(set = 3, binding = 1, rgba16f) uniform writeonly image3D gridVelocityImage;
+layout(set = 3, binding = 4) uniform sampler3D gridVelocityTexture;
+
+// GridBounds in Scene.h: bounds of this step's curve points as OrderedFloat, reduced by gridBounds.comp.
+// Cleared by the renderer to an empty box every step
+layout(set = 3, binding = 3) buffer GridBounds {
+	uvec4 lo;
+	uvec4 hi;
+} gridBounds;
+
+// GridBricks in Scene.h. The first three words are the indirect dispatch of gridNormalize and gridRelease, one
+// workgroup per claimed brick. gridRelease empties the entries each step used and the renderer clears the counters
+layout(set = 3, binding = 2) buffer GridBricks {
+	uint numBricks;   // claimed this step, runs past GRID_MAX_BRICKS when the pool is full
+	uint groupCountY; // = 1
+	uint groupCountZ; // = 1
+	uint maxBrickPoints; // most points reaching one brick, only counted for fixed point sums
+	uint bricks[GRID_BRICKS_PER_AXIS * GRID_BRICKS_PER_AXIS * GRID_BRICKS_PER_AXIS]; // slot + 1, 0 if empty, GRID_BRICK_FULL if it got no slot
+	uint brickPoints[GRID_BRICKS_PER_AXIS * GRID_BRICKS_PER_AXIS * GRID_BRICKS_PER_AXIS];
+	uint slotBricks[GRID_BRICKS_PER_AXIS * GRID_BRICKS_PER_AXIS * GRID_BRICKS_PER_AXIS]; // brick claimed as each slot, storage or not
+} gridBricks;
+
+// Curve points of pool strand s at [s * NUM_CURVE_POINTS, (s + 1) * NUM_CURVE_POINTS), root first.
+// The hair passes read positions too (shaders/hairStrands.glsl), velocities only exist for the simulation.
+layout(set = 4, binding = 0) buffer Positions {
+	vec4 positions[];
+};
+
+layout(set = 4, binding = 2) buffer Velocities {
+	vec4 velocities[];
+};
+
+// PackedStrandWords in Strand.h: fp32 root, then a snorm16 xyz offset from it per curve point packed back to
+// back, PACKED_STRAND_WORDS words per strand. The render positions of a draw slot's strand pool, only bound
+// when the renderer packs positions
+layout(set = 4, binding = 3) buffer PackedPositions {
+	uint packedPositions[];
+};
+
+// Point sort scratch, two halves of NumSimulatedPoints() entries each radix pass reads one of and writes the
+// other. sortedPoints holds curve point indices, the sorted order ends up in its second half.
+// sortHistograms holds the digit counts of each tile, digit major, scanned in place into scatter offsets
+layout(set = 4, binding = 4) buffer SortKeys {
+	uint sortKeys[];
+};
+
+layout(set = 4, binding = 5) buffer SortedPoints {
+	uint sortedPoints[];
+};
+
+layout(set = 4, binding = 6) buffer SortHistograms {
+	uint sortHistograms[];
+};
+
+// SimulationLodGroup in Strand.h, the level the renderer picked for one hair group of the pool this frame
+struct SimulationLodGroup {
+	uint firstStrand;
+	uint numStrands;
+	uint level;
+	uint solver;
+	uint firstLodStrand;
+	uint numGuides;
+	uint firstGuide;
+	uint firstInterpolated;
+};
+
+// SimulationLod in Strand.h, followed by the table of the groups in pool order. dispatches are read by the
+// indirect dispatches of the stages running over all the guides or the interpolated strands
+layout(set = 4, binding = 7) readonly buffer SimulationLod {
+	uint numGuides;
+	uint numInterpolated;
+	uint numGroups;
+	uint restSteps;
+	uvec4 dispatches[NUM_LOD_DISPATCHES];
+	uvec4 awakeWorkgroups[NUM_AWAKE_DISPATCHES];
+	SimulationLodGroup groups[];
+} lod;
+
+// BuildSimulationLods in Strand.h for each group, one after the other: per level its guides, then the strands it
+// interpolates, as pool strand indices
+layout(set = 4, binding = 8) readonly buffer LodStrands {
+	uint lodStrands[];
+};
+
+// LOD_NEIGHBORS guides per level and strand of each group, level major, as pool strand index and weight bits. Same
+// group layout as lodStrands, so a strand's neighbors at the group's level start at its firstLodStrand
+layout(set = 4, binding = 9) readonly buffer LodNeighbors {
+	uvec2 lodNeighbors[];
+};
+
+// AwakeStrands in Strand.h: the guides compactAwake.comp found moving this step and the indirect dispatches of
+// the stages running over them. Cleared by the renderer every step
+layout(set = 4, binding = 10) buffer AwakeStrands {
+	uint numAwakeStrands;
+	uint padding[3];
+	uvec4 dispatches[NUM_AWAKE_DISPATCHES];
+	uint strands[];
+} awake;
+
+// Steps in a row each strand of the pool has been calm for, it rests at lod.restSteps
+layout(set = 4, binding = 11) buffer RestingSteps {
+	uint restingSteps[];
+};
+
+
+// Every strand of the pool, the guides and the strands interpolated from them
+uint NumPoolStrands() {
+	return uint(positions.length()) / NUM_CURVE_POINTS;
+}
+
+
+// First strand (field 0), guide (1) or interpolated strand (2) of group g
+uint GroupStart(uint g, uint field) {
+	return field == 0u ? lod.groups[g].firstStrand : field == 1u ? lod.groups[g].firstGuide : lod.groups[g].firstInterpolated;
+}
+
+
+// Last group starting at or before i in the field, see GroupStart. The groups are few and in pool order
+uint FindGroup(uint i, uint field) {
+	uint lo = 0u;
+	uint hi = lod.numGroups - 1u;
+	while (lo < hi) {
+		uint mid = (lo + hi + 1u) / 2u;
+		if (GroupStart(mid, field) <= i) {
+			lo = mid;
+		}
+		else {
+			hi = mid - 1u;
+		}
+	}
+	return lo;
+}
+
+
+// Group of a pool strand
+uint StrandGroup(uint strandIdx) {
+	return FindGroup(strandIdx, 0u);
+}
+
+
+// Guides of every group's current LOD, the rest are interpolated from them
+uint NumGuideStrands() {
+	return lod.numGuides;
+}
+
+
+// Pool strand of the i-th guide, group by group in buffer order
+uint GuideStrand(uint i) {
+	uint g = FindGroup(i, 1u);
+	return lodStrands[lod.groups[g].firstLodStrand + i - lod.groups[g].firstGuide];
+}
+
+
+// Strands interpolated from the guides, of every group
+uint NumInterpolatedStrands() {
+	return lod.numInterpolated;
+}
+
+
+// Pool strand of the i-th interpolated strand, and the group it is in
+uint InterpolatedStrand(uint i, out uint g) {
+	g = FindGroup(i, 2u);
+	return lodStrands[lod.groups[g].firstLodStrand + lod.groups[g].numGuides + i - lod.groups[g].firstInterpolated];
+}
+
+
+// Guides stepped this step, the ones that aren't resting
+uint NumSimulatedStrands() {
+	return awake.numAwakeStrands;
+}
+
+
+// Strand of the i-th awake guide
+uint SimulatedStrand(uint i) {
+	return awake.strands[i];
+}
+
+
+// Curve points moved by the simulation, every point of the guides but the roots
+uint NumSimulatedPoints() {
+	return NumSimulatedStrands() * uint(NUM_CURVE_POINTS - 1);
+}
+
+
+// Curve point of simulated point threadIdx in strand order: the points after each root, guide by guide
+uint SimulatedPoint(uint threadIdx) {
+	return SimulatedStrand(threadIdx / (NUM_CURVE_POINTS - 1)) * NUM_CURVE_POINTS + threadIdx % (NUM_CURVE_POINTS - 1) + 1;
+}
+
+
+// Curve point the grid transfers give invocation threadIdx, neighbouring cells to neighbouring invocations
+// when the points are sorted
+uint GridTransferPoint(uint threadIdx) {
+	return SORT_GRID_POINTS ? sortedPoints[NumSimulatedPoints() + threadIdx] : SimulatedPoint(threadIdx);
+}
+
+
+// Maps floats to uints with the same order, so atomicMin and atomicMax can reduce them
+uint OrderedFloat(float f) {
+	uint u = floatBitsToUint(f);
+	return (u & 0x80000000u) != 0u ? ~u : u | 0x80000000u;
+}
+
+
+float UnorderedFloat(uint u) {
+	return uintBitsToFloat((u & 0x80000000u) != 0u ? u & 0x7FFFFFFFu : ~u);
+}
+
+
+// Cell (0, 0, 0) of the grid this step is at xyz, each cell is w wide. Same as FitGrid in Scene.h
+vec4 GridFrame() {
+	vec3 lo = vec3(UnorderedFloat(gridBounds.lo.x), UnorderedFloat(gridBounds.lo.y), UnorderedFloat(gridBounds.lo.z));
+	vec3 hi = vec3(UnorderedFloat(gridBounds.hi.x), UnorderedFloat(gridBounds.hi.y), UnorderedFloat(gridBounds.hi.z));
+	if (!all(lessThanEqual(lo, hi))) {
+		return vec4(-3.0, -2.0, -5.0, float(GRID_HEIGHT) / float(GRID_DIM));
+	}
+
+	vec3 size = hi - lo;
+	float extent = max(max(size.x, size.y), size.z);
+	float cellSize = max(ceil(extent / float(GRID_DIM - 3) / GRID_CELL_STEP), 1.0) * GRID_CELL_STEP;
+	return vec4(floor(lo / cellSize) * cellSize - cellSize, cellSize);
+}
+
+
+// Position of a point in grid cell units
+vec3 GridPosition(vec3 position) {
+	vec4 frame = GridFrame();
+	return (position - frame.xyz) / frame.w;
+}
+
+
+// Brick holding the grid cell at a, b, c
+uint GridBrick(int a, int b, int c) {
+	return uint(a / GRID_BRICK_DIM + (b / GRID_BRICK_DIM) * GRID_BRICKS_PER_AXIS + (c / GRID_BRICK_DIM) * GRID_BRICKS_PER_AXIS * GRID_BRICKS_PER_AXIS);
+}
+
+
+// Cell of the grid at local cell index local (0 to GRID_BRICK_CELLS - 1) of a brick
+ivec3 BrickCell(uint brick, uint local) {
+	uvec3 brickCell = uvec3(brick % GRID_BRICKS_PER_AXIS, (brick / GRID_BRICKS_PER_AXIS) % GRID_BRICKS_PER_AXIS, brick / (GRID_BRICKS_PER_AXIS * GRID_BRICKS_PER_AXIS));
+	uvec3 localCell = uvec3(local % GRID_BRICK_DIM, (local / GRID_BRICK_DIM) % GRID_BRICK_DIM, local / (GRID_BRICK_DIM * GRID_BRICK_DIM));
+	return ivec3(brickCell * GRID_BRICK_DIM + localCell);
+}
+
+
+// Index in grid.cells of the cell at a, b, c, or -1 when its brick has no storage this step
+int GridCellSlot(int a, int b, int c) {
+	uint entry = gridBricks.bricks[GridBrick(a, b, c)];
+	if (entry == 0u || entry == GRID_BRICK_FULL) {
+		return -1;
+	}
+	int local = a % GRID_BRICK_DIM + (b % GRID_BRICK_DIM) * GRID_BRICK_DIM + (c % GRID_BRICK_DIM) * GRID_BRICK_DIM * GRID_BRICK_DIM;
+	return int(entry - 1u) * GRID_BRICK_CELLS + local;
+}
+
+
+// Fixed point scale of the grid sums this step. A cell's sums take at most one contribution of at most
+// GRID_MAX_SPEED per point reaching its brick, so they stay within GRID_FIXED_POINT_RANGE however dense
+// the hair gets, and sparse hair keeps more precision. Same as GridScale in Scene.h
+float GridScale() {
+	return GRID_FIXED_POINT_RANGE / (float(max(gridBricks.maxBrickPoints, 1u)) * GRID_MAX_SPEED);
+}
+
+
+// Interleaves the bits of a grid cell index, cells close in the grid get close codes
+uint CellMortonCode(uvec3 cell) {
+	uint code = 0u;
+	for (int bit = 0; bit < 6; ++bit) {
+		code |= ((cell.x >> bit) & 1u) << (3 * bit) | ((cell.y >> bit) & 1u) << (3 * bit + 1) | ((cell.z >> bit) & 1u) << (3 * bit + 2);
+	}
+	return code;
+}
+
+
+// Trilinear weight of the cell at a, b, c for a point at grid position p
+float GridWeight(vec3 p, int a, int b, int c) {
+	float xWeight = clamp(1.0 - abs(p.x - a), 0.0, 1.0);
+	float yWeight = clamp(1.0 - abs(p.y - b), 0.0, 1.0);
+	float zWeight = clamp(1.0 - abs(p.z - c), 0.0, 1.0);
+	return xWeight * yWeight * zWeight;
+}
+
+
+// Collider j moved to where it is over the current substep, see Collider::Substep in Scene.h
+Collider SubstepCollider(uint j) {
+	Collider c = colliders[j];
+	vec4 previous = c.previousCenter;
+	c.previousCenter = mix(previous, c.center, sweepBegin);
+	c.center = mix(previous, c.center, sweepEnd);
+	return c;
+}
+
+
+// Broad phase: mask of the colliders whose bounding sphere reaches the box around a strand's curve points
+// anywhere along the way the collider moved this step. Only those can touch any of its points
+uvec2 StrandColliders(vec3 lo, vec3 hi) {
+	uvec2 candidates = uvec2(0u);
+	for (uint j = 0u; j < numColliders; ++j) {
+		Collider c = SubstepCollider(j);
+		vec3 center = 0.5 * (c.center.xyz + c.previousCenter.xyz);
+		float reach = c.center.w + 0.5 * distance(c.center.xyz, c.previousCenter.xyz);
+		if (distance(clamp(center, lo, hi), center) <= reach) {
+			candidates[j / 32u] |= 1u << (j % 32u);
+		}
+	}
+	return candidates;
+}
+
+
+// Whether any of the candidate colliders moved this step
+bool CollidersMoved(uvec2 candidates) {
+	for (int word = 0; word < 2; ++word) {
+		uint bits = candidates[word];
+		while (bits != 0u) {
+			Collider c = SubstepCollider(uint(32 * word + findLSB(bits)));
+			bits &= bits - 1u;
+			if (c.center.xyz != c.previousCenter.xyz) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+
+// Point in the space where the collider centered at center is the unit sphere, and back
+vec3 ColliderLocal(Collider c, vec3 center, vec3 point) {
+	vec3 offset = point - center;
+	return vec3(dot(offset, c.axes[0].xyz), dot(offset, c.axes[1].xyz), dot(offset, c.axes[2].xyz)) / c.radii.xyz;
+}
+
+vec3 ColliderWorld(Collider c, vec3 local) {
+	vec3 scaled = local * c.radii.xyz;
+	return c.center.xyz + scaled.x * c.axes[0].xyz + scaled.y * c.axes[1].xyz + scaled.z * c.axes[2].xyz;
+}
+
+
+// Moves a point out of every candidate collider and the SDF collider it ended up inside, onto the surface.
+// The point went from previous to position this step while each collider went from previousCenter to center.
+// A point the collider's surface swept over is caught where the surface first reached it, so a collider that
+// moved further than the point is deep can't carry it through to the far side
+vec3 ProjectCollisions(vec3 previous, vec3 position, uvec2 candidates) {
+	for (int word = 0; word < 2; ++word) {
+		uint bits = candidates[word];
+		while (bits != 0u) {
+			Collider c = SubstepCollider(uint(32 * word + findLSB(bits)));
+			bits &= bits - 1u;
+
+			// Path of the point in the collider's frame, against the unit sphere
+			vec3 start = ColliderLocal(c, c.previousCenter.xyz, previous);
+			vec3 local = ColliderLocal(c, c.center.xyz, position);
+			vec3 path = local - start;
+			float a = dot(path, path);
+			float b = dot(start, path);
+			float startOutside = dot(start, start) - 1.0;
+			float discriminant = b * b - a * startOutside;
+
+			if (startOutside > 0.0 && b < 0.0 && discriminant >= 0.0 && -b - sqrt(discriminant) <= a) {
+				local = start + path * ((-b - sqrt(discriminant)) / a);
+			}
+			else if (dot(local, local) < 1.0) {
+				local = normalize(local);
+			}
+			else {
+				continue;
+			}
+			position = ColliderWorld(c, local);
+		}
+	}
+
+	// The SDF collider doesn't move, one fetch gives how deep the point is and the way out. The gradient vanishes
+	// on the medial axis, where there is no way out to take
+	if (sdfFrame.w > 0.0) {
+		vec4 sdf = texture(sdfTexture, ((position - sdfFrame.xyz) / sdfFrame.w + 0.5) / vec3(textureSize(sdfTexture, 0)));
+		if (sdf.w < 0.0 && dot(sdf.xyz, sdf.xyz) > 1e-12) {
+			position -= sdf.w * normalize(sdf.xyz);
+		}
+	}
+
+	return position;
+}